@@ -0,0 +1,125 @@
+#include "allocation_counter.h"
+
+//how many library scopes the thread is in
+static __thread int libraryDepth = 0;
+
+void allocation_counter::enterLibrary()
+{
+    libraryDepth ++;
+}
+
+void allocation_counter::leaveLibrary()
+{
+    libraryDepth --;
+}
+
+#ifdef COUNT_ALLOCATIONS
+
+#include <stddef.h>
+#include <errno.h>
+
+#include <boost/atomic.hpp>
+
+//glibc's own allocator, under the names it exports for programs that
+//replace malloc
+extern "C" {
+    void * __libc_malloc( size_t size );
+    void * __libc_calloc( size_t count, size_t size );
+    void * __libc_realloc( void * p, size_t size );
+    void * __libc_memalign( size_t alignment, size_t size );
+    void __libc_free( void * p );
+}
+
+static boost::atomic< unsigned long > numAllocations( 0 );
+static boost::atomic< unsigned long > numBytes( 0 );
+
+static inline void countAllocation( size_t size )
+{
+    if ( libraryDepth > 0 ){
+        return;
+    }
+    numAllocations.fetch_add( 1, boost::memory_order_relaxed );
+    numBytes.fetch_add( size, boost::memory_order_relaxed );
+}
+
+//operator new, cv::fastMalloc and Eigen's aligned allocator all end up in
+//these, so replacing them counts the allocations of the libraries too.
+extern "C" {
+
+void * malloc( size_t size )
+{
+    countAllocation( size );
+    return __libc_malloc( size );
+}
+
+void * calloc( size_t count, size_t size )
+{
+    countAllocation( count * size );
+    return __libc_calloc( count, size );
+}
+
+void * realloc( void * p, size_t size )
+{
+    countAllocation( size );
+    return __libc_realloc( p, size );
+}
+
+void * memalign( size_t alignment, size_t size )
+{
+    countAllocation( size );
+    return __libc_memalign( alignment, size );
+}
+
+void * aligned_alloc( size_t alignment, size_t size )
+{
+    countAllocation( size );
+    return __libc_memalign( alignment, size );
+}
+
+int posix_memalign( void ** p, size_t alignment, size_t size )
+{
+    countAllocation( size );
+    *p = __libc_memalign( alignment, size );
+    return *p == NULL && size > 0 ? ENOMEM : 0;
+}
+
+void free( void * p )
+{
+    __libc_free( p );
+}
+
+}
+
+unsigned long allocation_counter::count()
+{
+    return numAllocations.load( boost::memory_order_relaxed );
+}
+
+unsigned long allocation_counter::bytes()
+{
+    return numBytes.load( boost::memory_order_relaxed );
+}
+
+bool allocation_counter::enabled()
+{
+    return true;
+}
+
+#else
+
+unsigned long allocation_counter::count()
+{
+    return 0;
+}
+
+unsigned long allocation_counter::bytes()
+{
+    return 0;
+}
+
+bool allocation_counter::enabled()
+{
+    return false;
+}
+
+#endif
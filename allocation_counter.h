@@ -0,0 +1,37 @@
+#ifndef ALLOCATION_COUNTER
+#define ALLOCATION_COUNTER
+
+//Counts the heap allocations of the program it is linked into, by
+//replacing glibc's malloc, calloc, realloc and aligned allocators. Those
+//are under operator new, cv::fastMalloc and Eigen's aligned allocations,
+//so the buffers of the libraries are counted as well, unless they are
+//made inside a library_scope. The counting functions are only built when
+//COUNT_ALLOCATIONS is defined; without it count and bytes always return 0
+//and enabled returns false.
+namespace allocation_counter
+{
+    //the number of allocations made so far by any thread, outside of the
+    //library scopes
+    unsigned long count();
+
+    //the bytes they asked for
+    unsigned long bytes();
+
+    bool enabled();
+
+    void enterLibrary();
+    void leaveLibrary();
+
+    //the allocations made by its thread while one is alive are not
+    //counted. The segmenter puts one around each call into pcl or opencv
+    //that allocates buffers of its own, so that the count is of the
+    //allocations the segmenter itself could avoid.
+    class library_scope
+    {
+    public:
+        library_scope() { enterLibrary(); }
+        ~library_scope() { leaveLibrary(); }
+    };
+}
+
+#endif
@@ -0,0 +1,299 @@
+#include "batch_processor.h"
+#include "frame_file.h"
+
+#include <fstream>
+#include <algorithm>
+
+#include <pcl/io/pcd_io.h>
+#include <pcl/common/time.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/bind.hpp>
+
+
+//returns the p-th percentile of a sorted vector of values
+static double percentile( const std::vector< double > & sorted, double p )
+{
+    if ( sorted.empty() ){
+        return 0;
+    }
+    size_t i = size_t( p * ( sorted.size() - 1 ) + 0.5 );
+    return sorted[ std::min( i, sorted.size() - 1 ) ];
+}
+
+
+BatchProcessor::BatchProcessor( const std::string & configFileName,
+                                int numThreads )
+                      : prototype( configFileName ),
+                        focalLength( 530.551 ),
+                        numThreads( numThreads ),
+                        wallTime( 0 )
+{
+    if ( this->numThreads <= 0 ){
+        this->numThreads = boost::thread::hardware_concurrency();
+    }
+    if ( this->numThreads <= 0 ){
+        this->numThreads = 1;
+    }
+}
+
+BatchProcessor::~BatchProcessor()
+{
+    for ( size_t i = 0; i < queues.size(); i ++ ){
+        delete queues[i];
+    }
+}
+
+void BatchProcessor::setFocalLength( float focalLength )
+{
+    this->focalLength = focalLength;
+}
+
+int BatchProcessor::addFrames( const std::string & input )
+{
+    std::vector< std::string > files;
+    frame_file::listPcdFiles( input, files );
+
+    //the frames were recorded when their files were written
+    std::vector< boost::uint64_t > timestamps;
+    frame_file::pcdTimestamps( files, timestamps );
+
+    for ( size_t i = 0; i < files.size(); i ++ ){
+        FrameJob job;
+        job.inputFile = files[i];
+        job.timestamp = timestamps[i];
+        job.loadTime = 0;
+        job.segmentTime = 0;
+        job.numPlanes = 0;
+        job.worker = -1;
+        job.ok = false;
+        frames.push_back( job );
+    }
+
+    return files.size();
+}
+
+void BatchProcessor::run( const std::string & outputDir )
+{
+    this->outputDir = outputDir;
+    if ( !outputDir.empty() ){
+        boost::filesystem::create_directories( outputDir );
+        const std::string resultFile = outputDir + "/results.seg";
+        if ( !resultWriter.open( resultFile ) ){
+            std::cerr << "error opening " << resultFile << "\n";
+        }
+    }
+
+    //hand every worker a contiguous block of frames to start with.
+    for ( size_t i = 0; i < queues.size(); i ++ ){
+        delete queues[i];
+    }
+    queues.resize( numThreads );
+    for ( int w = 0; w < numThreads; w ++ ){
+        queues[w] = new WorkerQueue;
+        const size_t begin = frames.size() * w / numThreads;
+        const size_t end = frames.size() * ( w + 1 ) / numThreads;
+        for ( size_t i = begin; i < end; i ++ ){
+            queues[w]->jobs.push_back( i );
+        }
+    }
+
+    pcl::StopWatch timer;
+
+    boost::thread_group workers;
+    for ( int w = 0; w < numThreads; w ++ ){
+        workers.create_thread( boost::bind( &BatchProcessor::workerLoop,
+                                            this, w ) );
+    }
+    workers.join_all();
+    resultWriter.close();
+
+    wallTime = timer.getTime();
+}
+
+bool BatchProcessor::popJob( int worker, int & job )
+{
+    {
+        WorkerQueue & own = *queues[ worker ];
+        boost::mutex::scoped_lock lock( own.mutex );
+        if ( !own.jobs.empty() ){
+            job = own.jobs.front();
+            own.jobs.pop_front();
+            return true;
+        }
+    }
+
+    //our own queue is empty, so steal from the back of the others,
+    //starting with our neighbour so that the thieves spread out.
+    for ( int i = 1; i < numThreads; i ++ ){
+        WorkerQueue & victim = *queues[ ( worker + i ) % numThreads ];
+        boost::mutex::scoped_lock lock( victim.mutex );
+        if ( !victim.jobs.empty() ){
+            job = victim.jobs.back();
+            victim.jobs.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void BatchProcessor::workerLoop( int worker )
+{
+    //every worker gets its own segmenter, they are not thread safe. The
+    //result is reused for all of the worker's frames.
+    PlaneSegmenter segmenter( prototype );
+    SegmentationResult result;
+
+    int job, lastJob = -1;
+    while ( popJob( worker, job ) ){
+        //the planes of the last frame only help if this one follows it.
+        if ( job != lastJob + 1 ){
+            segmenter.resetTracking();
+        }
+        lastJob = job;
+
+        frames[ job ].worker = worker;
+        processFrame( segmenter, result, frames[ job ] );
+    }
+}
+
+void BatchProcessor::processFrame( PlaneSegmenter & segmenter,
+                                   SegmentationResult & result, FrameJob & job )
+{
+    PointCloud::Ptr cloud( new PointCloud );
+
+    pcl::StopWatch timer;
+    try {
+        if ( pcl::io::loadPCDFile< Point >( job.inputFile, *cloud ) == -1 ){
+            std::cerr << "Couldn't read file " << job.inputFile << "\n";
+            return;
+        }
+    }
+    catch ( std::exception & e ){
+        std::cerr << "Error reading pcd file " << job.inputFile << ": "
+                  << e.what() << "\n";
+        return;
+    }
+    job.loadTime = timer.getTime();
+
+    if ( cloud->height <= 1 ){
+        std::cerr << "Skipping " << job.inputFile
+                  << ": the segmenter needs an organized cloud\n";
+        return;
+    }
+
+    segmenter.setCameraIntrinsics( focalLength, focalLength,
+                                   cloud->width / 2, cloud->height / 2 );
+
+    timer.reset();
+    segmenter.segment( cloud, result );
+    job.segmentTime = timer.getTime();
+
+    job.numPlanes = result.size();
+    job.ok = true;
+
+    if ( !outputDir.empty() ){
+        const std::string stem =
+            boost::filesystem::path( job.inputFile ).stem().string();
+        writeResults( outputDir + "/" + stem + ".planes.txt", result );
+
+        const unsigned int frame = &job - &frames[0];
+        boost::mutex::scoped_lock lock( resultMutex );
+        if ( resultWriter.isOpen() &&
+             !resultWriter.write( result, frame, job.timestamp ) ){
+            std::cerr << "error writing the results of " << job.inputFile
+                      << "\n";
+        }
+    }
+}
+
+//writes one line per plane and one line per 3d line segment.
+void BatchProcessor::writeResults( const std::string & file,
+                                   const SegmentationResult & result )
+{
+    std::ofstream ostr( file.c_str() );
+    if ( !ostr.is_open() ){
+        std::cerr << "error opening " << file << "\n";
+        return;
+    }
+
+    ostr << "# plane <index> <A> <B> <C> <D>\n"
+         << "# line <plane> <depth|intensity> <x0> <y0> <z0> <x1> <y1> <z1>\n";
+
+    for ( size_t i = 0; i < result.size(); i ++ ){
+        const std::vector< float > & c = result[i].coeffs.values;
+        ostr << "plane " << i;
+        for ( size_t j = 0; j < c.size(); j ++ ){
+            ostr << " " << c[j];
+        }
+        ostr << "\n";
+    }
+
+    for ( size_t i = 0; i < result.size(); i ++ ){
+        for ( int k = 0; k < 2; k ++ ){
+            const LinePosArray & lines = k == 0 ? result[i].depthLines
+                                                : result[i].intensityLines;
+            const char * kind = k == 0 ? "depth" : "intensity";
+            for ( size_t j = 0; j + 1 < lines.size(); j += 2 ){
+                ostr << "line " << i << " " << kind << " "
+                     << lines[j].x   << " " << lines[j].y   << " "
+                     << lines[j].z   << " "
+                     << lines[j+1].x << " " << lines[j+1].y << " "
+                     << lines[j+1].z << "\n";
+            }
+        }
+    }
+}
+
+void BatchProcessor::printReport( std::ostream & ostr ) const
+{
+    std::vector< double > latency, load;
+    std::vector< int > perWorker( numThreads, 0 );
+    int failed = 0;
+    long totalPlanes = 0;
+
+    for ( size_t i = 0; i < frames.size(); i ++ ){
+        const FrameJob & job = frames[i];
+        if ( !job.ok ){
+            failed ++;
+            continue;
+        }
+        latency.push_back( job.segmentTime );
+        load.push_back( job.loadTime );
+        totalPlanes += job.numPlanes;
+        if ( job.worker >= 0 && job.worker < numThreads ){
+            perWorker[ job.worker ] ++;
+        }
+    }
+    std::sort( latency.begin(), latency.end() );
+    std::sort( load.begin(), load.end() );
+
+    double mean = 0;
+    for ( size_t i = 0; i < latency.size(); i ++ ){
+        mean += latency[i];
+    }
+    if ( !latency.empty() ){
+        mean /= latency.size();
+    }
+
+    const double seconds = wallTime / 1000.0;
+
+    ostr << "frames processed: " << latency.size()
+         << " (" << failed << " failed) with " << numThreads << " threads\n"
+         << "wall time: " << seconds << " s, "
+         << ( seconds > 0 ? latency.size() / seconds : 0 ) << " frames/sec\n"
+         << "segment latency (ms): mean " << mean
+         << " p50 " << percentile( latency, 0.50 )
+         << " p99 " << percentile( latency, 0.99 )
+         << " max " << ( latency.empty() ? 0 : latency.back() ) << "\n"
+         << "load latency (ms): p50 " << percentile( load, 0.50 )
+         << " p99 " << percentile( load, 0.99 ) << "\n"
+         << "planes per frame: "
+         << ( latency.empty() ? 0 : double( totalPlanes ) / latency.size() )
+         << "\n"
+         << "frames per worker:";
+    for ( int w = 0; w < numThreads; w ++ ){
+        ostr << " " << perWorker[w];
+    }
+    ostr << "\n";
+}
@@ -0,0 +1,100 @@
+#ifndef BATCH_PROCESSOR
+#define BATCH_PROCESSOR
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <iostream>
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "plane_segmenter.h"
+#include "result_io.h"
+
+//The BatchProcessor pushes a recorded sequence of pcd frames through the
+//PlaneSegmenter without any gui. Every worker thread owns its own copy of
+//the segmenter, and the frames are handed out through a set of work
+//stealing queues so that a worker that runs out of frames takes work from
+//the others instead of sitting idle.
+class BatchProcessor
+{
+public:
+    typedef PlaneSegmenter::Point Point;
+    typedef PlaneSegmenter::PointCloud PointCloud;
+    typedef PlaneSegmenter::LinePosArray LinePosArray;
+
+    //numThreads <= 0 uses one worker per hardware thread.
+    BatchProcessor( const std::string & configFileName, int numThreads=0 );
+    ~BatchProcessor();
+
+    //the focal length used to project the lines into space. The image
+    //center is taken from the size of each cloud.
+    void setFocalLength( float focalLength );
+
+    //adds the frames to process. If input is a directory, every .pcd file
+    //in it is added, ordered by the number at the end of the file name.
+    //Otherwise input is treated as a prefix and the files input0.pcd,
+    //input1.pcd, ... are added until one is missing.
+    //returns the number of frames that were added.
+    int addFrames( const std::string & input );
+
+    //process every frame that was added. If outputDir is not empty, the
+    //planes and lines of each frame are written to a text file in it, and
+    //the results of all of the frames to the result file results.seg.
+    //The records are in the order the frames finished, their frame
+    //number is the position of the frame in the sequence.
+    void run( const std::string & outputDir );
+
+    //prints frames/sec and the per-frame latency of the last run.
+    void printReport( std::ostream & ostr ) const;
+
+    int numFrames() const { return frames.size(); }
+
+private:
+
+    struct FrameJob {
+        std::string inputFile;
+        boost::uint64_t timestamp;   //microseconds, when it was recorded
+        double loadTime;      //milliseconds spent reading the pcd file
+        double segmentTime;   //milliseconds spent in PlaneSegmenter::segment
+        int numPlanes;
+        int worker;
+        bool ok;
+    };
+
+    //each worker owns one of these. The owner pops from the front so that
+    //it walks through its block of frames in order, and thieves take from
+    //the back.
+    struct WorkerQueue {
+        boost::mutex mutex;
+        std::deque< int > jobs;
+    };
+
+    PlaneSegmenter prototype;
+    float focalLength;
+    int numThreads;
+
+    std::vector< FrameJob > frames;
+    std::vector< WorkerQueue * > queues;
+    std::string outputDir;
+    double wallTime;
+
+    ResultWriter resultWriter;
+    boost::mutex resultMutex;
+
+    //takes the next job for the given worker, stealing from the other
+    //queues once its own is empty. returns false when no work is left.
+    bool popJob( int worker, int & job );
+
+    void workerLoop( int worker );
+
+    void processFrame( PlaneSegmenter & segmenter, SegmentationResult & result,
+                       FrameJob & job );
+
+    void writeResults( const std::string & file,
+                       const SegmentationResult & result );
+
+};
+
+#endif
@@ -0,0 +1,42 @@
+#include "batch_processor.h"
+
+
+void printUsage(){
+    std::cout << "Usage: ./batch_segmenter <input> [output directory] [threads]"
+            << " [config file]\n"
+         << "Segments a recorded sequence of pcd files without a gui.\n"
+         << "The input is either a directory of pcd files, or a prefix such"
+            << " that the frames are <prefix>0.pcd, <prefix>1.pcd, ...\n"
+         << "If an output directory is given, the planes and lines of every"
+            << " frame are written to it, as text files and as one binary"
+            << " results.seg file.\n"
+         << "By default one thread is used per core and the config file is"
+            << " ../config.txt\n";
+}
+
+
+int main (int argc, char * argv[])
+{
+    if ( argc < 2 || argc > 5 ){
+        printUsage();
+        return 1;
+    }
+
+    const std::string input = argv[1];
+    const std::string outputDir = argc >= 3 ? argv[2] : "";
+    const int threads = argc >= 4 ? atoi( argv[3] ) : 0;
+    const std::string configFile = argc >= 5 ? argv[4] : "../config.txt";
+
+    BatchProcessor processor( configFile, threads );
+
+    if ( processor.addFrames( input ) == 0 ){
+        std::cerr << "no frames found for " << input << "\n";
+        return 1;
+    }
+
+    std::cout << "Segmenting " << processor.numFrames() << " frames\n";
+    processor.run( outputDir );
+    processor.printReport( std::cout );
+
+    return 0;
+}
@@ -0,0 +1,302 @@
+#include "synthetic_scene.h"
+#include "allocation_counter.h"
+#include "result_io.h"
+
+#include <algorithm>
+#include <stdlib.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <pcl/common/time.h>
+
+
+void printUsage(){
+    std::cout << "Usage: ./bench_plane_segmenter [frames] [config file]"
+            << " [max allocations]\n"
+         << "Times PlaneSegmenter::segment on synthetic 640x480 scenes with"
+            << " 1, 4, 8 and 16 planes and scores the planes and lines it"
+            << " finds against the ground truth.\n"
+         << "frames is the number of timed frames per plane count"
+            << " (default 30), the config file defaults to ../config.txt\n"
+         << "Built with COUNT_ALLOCATIONS, it also counts the heap"
+            << " allocations that each call to segment makes outside of"
+            << " pcl and opencv, and fails if they are more than max"
+            << " allocations per frame on average (default 0: once warmed"
+            << " up the segmenter allocates nothing of its own).\n"
+         << "It always fails if a frame reallocates its label image, or"
+            << " if the results do not read back the same from a result"
+            << " file.\n";
+}
+
+static bool samePoint( const float * stored, const pcl::PointXYZ & p )
+{
+    return stored[0] == p.x && stored[1] == p.y && stored[2] == p.z;
+}
+
+//compares frame f of a result file with the result it was written from.
+//returns a description of the first difference, or an empty string.
+static std::string compareFrame( const ResultReader & reader, size_t f,
+                                 const SegmentationResult & result,
+                                 unsigned int frame,
+                                 boost::uint64_t timestamp )
+{
+    const result_frame_header & header = reader.frame( f );
+    if ( header.frame != frame || header.timestamp != timestamp ){
+        return "frame number or timestamp";
+    }
+    if ( header.numPlanes != result.size() ){
+        return "number of planes";
+    }
+
+    const result_plane * planes = reader.planes( f );
+    const result_line * lines = reader.lines( f );
+    for ( size_t i = 0; i < result.size(); i ++ ){
+        const plane_data & plane = result[i];
+        const result_plane & stored = planes[i];
+        for ( int j = 0; j < 4; j ++ ){
+            if ( stored.coeffs[j] != plane.coeffs.values[j] ){
+                return "plane coefficients";
+            }
+        }
+        if ( stored.numPixels != plane.numPixels ||
+             stored.bbox[0] != plane.bbox.x ||
+             stored.bbox[1] != plane.bbox.y ||
+             stored.bbox[2] != plane.bbox.width ||
+             stored.bbox[3] != plane.bbox.height ){
+            return "plane inliers or bounding box";
+        }
+        if ( stored.numDepthLines != plane.depthPixels.size() ||
+             stored.numIntensityLines != plane.intensityPixels.size() ||
+             stored.firstLine + stored.numDepthLines +
+             stored.numIntensityLines > header.numLines ){
+            return "number of lines";
+        }
+
+        //the depth lines come first, then the intensity lines
+        for ( int k = 0; k < 2; k ++ ){
+            const std::vector< cv::Vec4i > & pixels =
+                            k == 0 ? plane.depthPixels : plane.intensityPixels;
+            const std::vector< pcl::PointXYZ > & ends =
+                            k == 0 ? plane.depthLines : plane.intensityLines;
+            const result_line * first = lines + stored.firstLine +
+                                        ( k == 0 ? 0 : stored.numDepthLines );
+            for ( size_t j = 0; j < pixels.size(); j ++ ){
+                const result_line & line = first[j];
+                for ( int c = 0; c < 4; c ++ ){
+                    if ( line.pixels[c] != pixels[j][c] ){
+                        return "line pixels";
+                    }
+                }
+                if ( !samePoint( line.start, ends[ 2 * j ] ) ||
+                     !samePoint( line.end, ends[ 2 * j + 1 ] ) ){
+                    return "line ends";
+                }
+            }
+        }
+    }
+    return "";
+}
+
+//writes the results of the scenes to a result file, maps it back in and
+//checks that every field reads back the way it was written. returns false,
+//with a message, if one does not.
+static bool checkResultFile( PlaneSegmenter & segmenter,
+        const std::vector< SyntheticScene::PointCloud::Ptr > & clouds )
+{
+    namespace fs = boost::filesystem;
+    const fs::path path = fs::temp_directory_path() /
+                          fs::unique_path( "bench-%%%%-%%%%.seg" );
+
+    //frame f is written as frame 10 f, a third of a second apart, so
+    //neither is just the index
+    const size_t numScenes = clouds.size();
+    std::vector< boost::shared_ptr< SegmentationResult > > results;
+    ResultWriter writer;
+    bool written = writer.open( path.string() );
+    for ( size_t s = 0; s < numScenes && written; s ++ ){
+        results.push_back( boost::shared_ptr< SegmentationResult >(
+                                               new SegmentationResult ) );
+        segmenter.segment( clouds[s], *results.back() );
+        written = writer.write( *results.back(), 10 * s, 333333 * s + 1 );
+    }
+    writer.close();
+
+    std::string difference;
+    ResultReader reader;
+    if ( !written ){
+        difference = "the file could not be written";
+    } else if ( !reader.open( path.string() ) ){
+        difference = "the file could not be read";
+    } else if ( reader.numFrames() != numScenes ){
+        difference = "number of frames";
+    }
+    for ( size_t s = 0; s < numScenes && difference.empty(); s ++ ){
+        difference = compareFrame( reader, s, *results[s], 10 * s,
+                                   333333 * s + 1 );
+    }
+    reader.close();
+    fs::remove( path );
+
+    if ( !difference.empty() ){
+        std::cout << "\tFAILED: the result file does not read back the"
+                  << " same: " << difference << "\n";
+        return false;
+    }
+    return true;
+}
+
+//returns the p-th percentile of a sorted vector of values
+static double percentile( const std::vector< double > & sorted, double p )
+{
+    if ( sorted.empty() ){
+        return 0;
+    }
+    size_t i = size_t( p * ( sorted.size() - 1 ) + 0.5 );
+    return sorted[ std::min( i, sorted.size() - 1 ) ];
+}
+
+
+int main (int argc, char * argv[])
+{
+    if ( argc > 4 ){
+        printUsage();
+        return 1;
+    }
+
+    const int numFrames = argc >= 2 ? std::max( 1, atoi( argv[1] ) ) : 30;
+    const std::string configFile = argc >= 3 ? argv[2] : "../config.txt";
+    const double maxAllocations = argc >= 4 ? atof( argv[3] ) : 0;
+
+    //every timed frame cycles through this many different scenes.
+    const int numScenes = 5;
+    const int planeCounts[] = { 1, 4, 8, 16 };
+    const int numPlaneCounts = sizeof( planeCounts ) / sizeof( int );
+
+    const PlaneSegmenter prototype( configFile );
+    SyntheticScene scene;
+
+    std::cout << "\nplanes  frames/sec  p50(ms)  p99(ms)  planeRecall"
+              << "  planePrecision  normalErr(deg)  lineRecall  linePrecision";
+    if ( allocation_counter::enabled() ){
+        std::cout << "  allocs/frame  KB/frame";
+    }
+    std::cout << "\n";
+
+    bool failed = false;
+    for ( int c = 0; c < numPlaneCounts; c ++ ){
+        const int numPlanes = planeCounts[c];
+
+        std::vector< SyntheticScene::PointCloud::Ptr > clouds;
+        std::vector< SyntheticScene > truths;
+        for ( int s = 0; s < numScenes; s ++ ){
+            SyntheticScene::PointCloud::Ptr cloud(
+                                        new SyntheticScene::PointCloud );
+            scene.generate( numPlanes, 1000 * numPlanes + s, *cloud );
+            clouds.push_back( cloud );
+            truths.push_back( scene );
+        }
+
+        PlaneSegmenter segmenter( prototype );
+        segmenter.setCameraIntrinsics( scene.getFocalLength(),
+                                       scene.getFocalLength(),
+                                       scene.getWidth() / 2,
+                                       scene.getHeight() / 2 );
+        segmenter.setPlaneLimits( numPlanes, scene.smallestPlane() / 2 );
+
+        //one untimed pass over the scenes to warm up the caches and grow
+        //the buffers to the largest frame. The result is reused for every
+        //frame, like a real caller would.
+        SegmentationResult result;
+        for ( int s = 0; s < numScenes; s ++ ){
+            segmenter.segment( clouds[s], result );
+        }
+        const unsigned char * labelBuffer = result.empty() ? NULL :
+                                                     result[0].labels.data;
+        int movedLabels = 0;
+
+        std::vector< double > latency;
+        segmentation_stats frameStats, totalStats;
+        double recall = 0, precision = 0, normalError = 0;
+        double lineRecall = 0, linePrecision = 0;
+        unsigned long allocations = 0, allocatedBytes = 0;
+
+        for ( int f = 0; f < numFrames; f ++ ){
+            const int s = f % numScenes;
+
+            const unsigned long allocationsBefore =
+                                        allocation_counter::count();
+            const unsigned long bytesBefore = allocation_counter::bytes();
+            pcl::StopWatch timer;
+            segmenter.segment( clouds[s], result, NULL, &frameStats );
+            latency.push_back( timer.getTime() );
+            allocations += allocation_counter::count() - allocationsBefore;
+            allocatedBytes += allocation_counter::bytes() - bytesBefore;
+            totalStats.accumulate( frameStats );
+
+            //the planes of every frame share one label image, which the
+            //segmenter draws in the same buffer every time
+            if ( !result.empty() ){
+                if ( labelBuffer != NULL &&
+                     result[0].labels.data != labelBuffer ){
+                    movedLabels ++;
+                }
+                labelBuffer = result[0].labels.data;
+            }
+
+            const scene_accuracy acc = truths[s].evaluate( result );
+            recall += acc.planeRecall();
+            precision += acc.planePrecision();
+            normalError += acc.normalError;
+            lineRecall += acc.lineRecall();
+            linePrecision += acc.linePrecision();
+        }
+
+        double total = 0;
+        for ( size_t i = 0; i < latency.size(); i ++ ){
+            total += latency[i];
+        }
+        std::sort( latency.begin(), latency.end() );
+
+        std::cout << numPlanes
+                  << "\t" << 1000.0 * numFrames / total
+                  << "\t" << percentile( latency, 0.50 )
+                  << "\t" << percentile( latency, 0.99 )
+                  << "\t" << recall / numFrames
+                  << "\t" << precision / numFrames
+                  << "\t" << normalError / numFrames
+                  << "\t" << lineRecall / numFrames
+                  << "\t" << linePrecision / numFrames;
+        const double allocationsPerFrame = double( allocations ) / numFrames;
+        if ( allocation_counter::enabled() ){
+            std::cout << "\t" << allocationsPerFrame
+                      << "\t" << allocatedBytes / 1024.0 / numFrames;
+        }
+        std::cout << "\n";
+
+        if ( !checkResultFile( segmenter, clouds ) ){
+            failed = true;
+        }
+        if ( movedLabels > 0 ){
+            std::cout << "\tFAILED: the label image was reallocated in "
+                      << movedLabels << " frames\n";
+            failed = true;
+        }
+        if ( allocation_counter::enabled() &&
+             allocationsPerFrame > maxAllocations ){
+            std::cout << "\tFAILED: " << allocationsPerFrame
+                      << " allocations per frame, the most allowed is "
+                      << maxAllocations << "\n";
+            failed = true;
+        }
+
+        std::cout << "\tms/frame:";
+        for ( int i = 0; i < segmentation_stats::NUM_STAGES; i ++ ){
+            std::cout << " " << segmentation_stats::stageName( i ) << " "
+                      << totalStats.stages[i].time / numFrames;
+        }
+        std::cout << "\n";
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,362 @@
+#include "door_detector.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <boost/bind.hpp>
+#include <boost/ref.hpp>
+
+#include "SimpleConfig.h"
+
+
+//orders lines longest first
+static bool longerLine( const std::pair< float, int > & a,
+                        const std::pair< float, int > & b )
+{
+    return a.first > b.first;
+}
+
+
+DoorDetector::DoorDetector() :
+        fx( 525 ), fy( 525 ), u0( 320 ), v0( 240 ),
+        minWidth( 0.6 ), maxWidth( 1.2 ), minHeight( 1.8 ), maxHeight( 2.4 ),
+        minLineLength( 0.15 ), angleTolerance( 10 ), edgeTolerance( 0.05 ),
+        minSupport( 0.5 ), planeTasks( 2 )
+{
+}
+
+DoorDetector::DoorDetector( const std::string & configFile ) :
+        fx( 525 ), fy( 525 ), u0( 320 ), v0( 240 )
+{
+    SimpleConfig config( configFile );
+
+    //get the door size parameters
+    config.get( "doorMinWidth", minWidth );
+    config.get( "doorMaxWidth", maxWidth );
+    config.get( "doorMinHeight", minHeight );
+    config.get( "doorMaxHeight", maxHeight );
+
+    //get the line parameters
+    config.get( "doorMinLineLength", minLineLength );
+    config.get( "doorAngleTolerance", angleTolerance );
+    config.get( "doorEdgeTolerance", edgeTolerance );
+    config.get( "doorMinSupport", minSupport );
+
+    int numThreads;
+    config.get( "doorThreads", numThreads );
+    planeTasks.setNumThreads( numThreads );
+}
+
+void DoorDetector::setCameraIntrinsics( float fx, float fy,
+                                        float u0, float v0 )
+{
+    this->fx = fx;
+    this->fy = fy;
+    this->u0 = u0;
+    this->v0 = v0;
+}
+
+void DoorDetector::setDoorSize( float minWidth, float maxWidth,
+                                float minHeight, float maxHeight )
+{
+    this->minWidth = minWidth;
+    this->maxWidth = maxWidth;
+    this->minHeight = minHeight;
+    this->maxHeight = maxHeight;
+}
+
+void DoorDetector::setLineLimits( float minLength, float angleTolerance,
+                                  float edgeTolerance )
+{
+    minLineLength = minLength;
+    this->angleTolerance = angleTolerance;
+    this->edgeTolerance = edgeTolerance;
+}
+
+void DoorDetector::setMinSupport( float minSupport )
+{
+    this->minSupport = minSupport;
+}
+
+void DoorDetector::setNumThreads( int numThreads )
+{
+    planeTasks.setNumThreads( numThreads );
+}
+
+bool DoorDetector::detect( const SegmentationResult & planes,
+                           door_candidate & door )
+{
+    door.plane = -1;
+    door.score = 0;
+
+    //every plane gets its own slot, so the tasks never share anything.
+    //The slots are kept from frame to frame.
+    planeBest.resize( planes.size() );
+    for ( size_t p = 0; p < planes.size(); p ++ ){
+        planeBest[p].plane = -1;
+        planeBest[p].score = 0;
+        planeTasks.run( boost::bind( &DoorDetector::searchPlane, this,
+                                     boost::cref( planes ), int( p ),
+                                     &planeBest[p] ) );
+    }
+    planeTasks.wait();
+
+    for ( size_t p = 0; p < planes.size(); p ++ ){
+        if ( planeBest[p].plane >= 0 && planeBest[p].score > door.score ){
+            door = planeBest[p];
+        }
+    }
+    return door.plane >= 0;
+}
+
+void DoorDetector::searchPlane( const SegmentationResult & planes, int p,
+                                door_candidate * best ) const
+{
+    const plane_data & plane = planes[p];
+    if ( plane.coeffs.values.size() < 4 ){
+        return;
+    }
+
+    //the camera's y axis points down, so a door's up is -y. The plane has
+    //to be close to upright for the door to be.
+    Eigen::Vector3f normal( plane.coeffs.values[0], plane.coeffs.values[1],
+                            plane.coeffs.values[2] );
+    const float norm = normal.norm();
+    if ( norm <= 0 ){
+        return;
+    }
+    normal /= norm;
+    const float d = plane.coeffs.values[3] / norm;
+
+    const Eigen::Vector3f cameraUp( 0, -1, 0 );
+    const float tilt = std::asin( std::min( 1.0f,
+                            std::fabs( normal.dot( cameraUp ) ) ) ) * 180 / M_PI;
+    if ( tilt > angleTolerance ){
+        return;
+    }
+    const float orientationScore = 1 - 0.5 * tilt / angleTolerance;
+
+    //the plane's own frame, with the across axis pointing to the right of
+    //the image
+    const Eigen::Vector3f up = ( cameraUp - normal.dot( cameraUp ) * normal )
+                                .normalized();
+    Eigen::Vector3f across = up.cross( normal );
+    if ( across[0] < 0 ){
+        across = -across;
+    }
+    const Eigen::Vector3f origin = -d * normal;
+
+    std::vector< plane_line > upright, level;
+    splitLines( plane.depthLines, origin, across, up, upright, level );
+    splitLines( plane.intensityLines, origin, across, up, upright, level );
+    if ( upright.size() < 2 ){
+        return;
+    }
+
+    //only the longest lines are paired, so a busy plane can not blow up
+    //the number of candidates
+    if ( upright.size() > MAX_LINES || level.size() > MAX_LINES ){
+        std::vector< plane_line > * sets[2] = { &upright, &level };
+        for ( int s = 0; s < 2; s ++ ){
+            std::vector< plane_line > & lines = *sets[s];
+            if ( lines.size() <= MAX_LINES ){
+                continue;
+            }
+            std::vector< std::pair< float, int > > lengths( lines.size() );
+            for ( size_t i = 0; i < lines.size(); i ++ ){
+                lengths[i] = std::make_pair( lines[i].end - lines[i].start,
+                                             int( i ) );
+            }
+            std::partial_sort( lengths.begin(), lengths.begin() + MAX_LINES,
+                               lengths.end(), longerLine );
+            std::vector< plane_line > longest( MAX_LINES );
+            for ( size_t i = 0; i < MAX_LINES; i ++ ){
+                longest[i] = lines[ lengths[i].second ];
+            }
+            lines.swap( longest );
+        }
+    }
+
+    //the weight of each side in the support. The bottom of a door is
+    //often hidden by the floor, so it counts for less.
+    const float sideWeight = 1.0, bottomWeight = 0.5;
+    const float totalWeight = 3 * sideWeight + bottomWeight;
+
+    std::vector< float > tops, bottoms;
+    for ( size_t i = 0; i < upright.size(); i ++ ){
+        for ( size_t j = 0; j < upright.size(); j ++ ){
+            const plane_line & left = upright[i];
+            const plane_line & right = upright[j];
+            const float width = right.along - left.along;
+            if ( width < minWidth || width > maxWidth ){
+                continue;
+            }
+
+            //the tops and bottoms are the level lines that reach across
+            //most of the gap between the sides, and the ends of the sides
+            tops.clear();
+            bottoms.clear();
+            tops.push_back( std::max( left.end, right.end ) );
+            bottoms.push_back( std::min( left.start, right.start ) );
+            for ( size_t k = 0; k < level.size(); k ++ ){
+                const float overlap =
+                    std::min( level[k].end, right.along ) -
+                    std::max( level[k].start, left.along );
+                if ( overlap < 0.5 * width ){
+                    continue;
+                }
+                tops.push_back( level[k].along );
+                bottoms.push_back( level[k].along );
+            }
+
+            for ( size_t t = 0; t < tops.size(); t ++ ){
+                for ( size_t b = 0; b < bottoms.size(); b ++ ){
+                    const float top = tops[t], bottom = bottoms[b];
+                    const float height = top - bottom;
+                    if ( height < minHeight || height > maxHeight ){
+                        continue;
+                    }
+
+                    //the support of the sides is measured over the whole
+                    //height of the candidate
+                    const float l = sideSupport( upright, left.along,
+                                                 bottom, top );
+                    const float r = sideSupport( upright, right.along,
+                                                 bottom, top );
+                    if ( l <= 0 || r <= 0 ){
+                        continue;
+                    }
+                    const float topSupport = sideSupport( level, top,
+                                                          left.along,
+                                                          right.along );
+                    const float bottomSupport = sideSupport( level, bottom,
+                                                             left.along,
+                                                             right.along );
+                    const float support = ( sideWeight * ( l + r +
+                                                           topSupport ) +
+                                            bottomWeight * bottomSupport ) /
+                                          totalWeight;
+                    if ( support < minSupport ){
+                        continue;
+                    }
+
+                    const float score = support * orientationScore *
+                                        sizeScore( width, minWidth,
+                                                   maxWidth ) *
+                                        sizeScore( height, minHeight,
+                                                   maxHeight );
+                    if ( score <= best->score ){
+                        continue;
+                    }
+
+                    best->plane = p;
+                    best->score = score;
+                    best->width = width;
+                    best->height = height;
+                    best->support = support;
+
+                    const Eigen::Vector3f corners[4] = {
+                        origin + left.along * across + top * up,
+                        origin + left.along * across + bottom * up,
+                        origin + right.along * across + bottom * up,
+                        origin + right.along * across + top * up };
+                    for ( int c = 0; c < 4; c ++ ){
+                        best->corners[c] = toPoint( corners[c] );
+                        best->pixels[c] = toPixel( corners[c] );
+                    }
+                }
+            }
+        }
+    }
+}
+
+void DoorDetector::splitLines( const std::vector< pcl::PointXYZ > & lines,
+                               const Eigen::Vector3f & origin,
+                               const Eigen::Vector3f & across,
+                               const Eigen::Vector3f & up,
+                               std::vector< plane_line > & upright,
+                               std::vector< plane_line > & level ) const
+{
+    const float cosTolerance = std::cos( angleTolerance * M_PI / 180 );
+
+    for ( size_t i = 0; i + 1 < lines.size(); i += 2 ){
+        const Eigen::Vector3f p0 = lines[i].getVector3fMap() - origin;
+        const Eigen::Vector3f p1 = lines[i+1].getVector3fMap() - origin;
+
+        const float a0 = p0.dot( across ), b0 = p0.dot( up );
+        const float a1 = p1.dot( across ), b1 = p1.dot( up );
+        const float length = std::sqrt( ( a1 - a0 ) * ( a1 - a0 ) +
+                                        ( b1 - b0 ) * ( b1 - b0 ) );
+
+        //the ends of a line that was seen almost edge on can land far
+        //away, or nowhere at all
+        if ( !( length >= minLineLength ) ){
+            continue;
+        }
+
+        plane_line line;
+        if ( std::fabs( b1 - b0 ) >= cosTolerance * length ){
+            line.along = ( a0 + a1 ) / 2;
+            line.start = std::min( b0, b1 );
+            line.end = std::max( b0, b1 );
+            upright.push_back( line );
+        } else if ( std::fabs( a1 - a0 ) >= cosTolerance * length ){
+            line.along = ( b0 + b1 ) / 2;
+            line.start = std::min( a0, a1 );
+            line.end = std::max( a0, a1 );
+            level.push_back( line );
+        }
+    }
+}
+
+float DoorDetector::sideSupport( const std::vector< plane_line > & lines,
+                                 float along, float start, float end ) const
+{
+    const float length = end - start;
+    if ( length <= 0 ){
+        return 0;
+    }
+
+    float covered = 0;
+    for ( size_t i = 0; i < lines.size(); i ++ ){
+        if ( std::fabs( lines[i].along - along ) > edgeTolerance ){
+            continue;
+        }
+        const float overlap = std::min( lines[i].end, end ) -
+                              std::max( lines[i].start, start );
+        if ( overlap > 0 ){
+            covered += overlap;
+        }
+    }
+
+    //lines found twice, in depth and in intensity, overlap
+    return std::min( 1.0f, covered / length );
+}
+
+float DoorDetector::sizeScore( float size, float min, float max )
+{
+    const float halfRange = ( max - min ) / 2;
+    if ( halfRange <= 0 ){
+        return 1;
+    }
+    const float off = std::fabs( size - ( min + halfRange ) ) / halfRange;
+    return 1 - 0.5 * std::min( 1.0f, off );
+}
+
+pcl::PointXYZ DoorDetector::toPoint( const Eigen::Vector3f & p ) const
+{
+    pcl::PointXYZ point;
+    point.x = p[0];
+    point.y = p[1];
+    point.z = p[2];
+    return point;
+}
+
+cv::Point DoorDetector::toPixel( const Eigen::Vector3f & p ) const
+{
+    if ( p[2] <= 0 ){
+        return cv::Point( -1, -1 );
+    }
+    return cv::Point( int( fx * p[0] / p[2] + u0 + 0.5 ),
+                      int( fy * p[1] / p[2] + v0 + 0.5 ) );
+}
@@ -0,0 +1,115 @@
+#ifndef DOOR_DETECTOR
+#define DOOR_DETECTOR
+
+#include <string>
+#include <vector>
+
+#include <pcl/point_types.h>
+#include <pcl/ModelCoefficients.h>
+
+#include "opencv2/core/core.hpp"
+
+#include "plane_segmenter.h"
+#include "task_group.h"
+
+//a door found in the lines of a plane. The corners go around the door:
+//top left, bottom left, bottom right and top right, as seen from the
+//camera, which is the order getDoorInfo takes them in.
+struct door_candidate {
+    int plane;                    //the index of the plane, -1 if none
+    float score;                  //0 to 1
+    float width, height;          //meters
+    float support;                //the part of the outline lines were found on
+    pcl::PointXYZ corners[4];
+    cv::Point pixels[4];          //the corners in the image
+};
+
+//DoorDetector finds doors without any clicks, from the lines that the
+//segmenter found on each plane.
+//
+//A plane is looked at in a frame of its own: one axis runs up the plane,
+//the other across it. The lines of the plane that run along one of the
+//axes are the possible sides of a door. Every pair of upright lines that
+//is as far apart as a door is wide, with every top and bottom between them
+//that makes it as tall as one, is a candidate. Its corners are where the
+//sides cross on the plane, and the ends of the upright lines stand in for
+//a top or bottom edge that was not seen.
+//
+//A candidate is scored by how much of its outline lies on lines, how close
+//it is to the usual size of a door, and how upright the plane is. The
+//planes are searched as tasks on a group of threads that is started with
+//the first frame and kept until the detector is destroyed.
+class DoorDetector
+{
+public:
+
+    DoorDetector();
+    DoorDetector( const std::string & configFile );
+
+    void setCameraIntrinsics( float fx, float fy, float u0, float v0 );
+
+    //the sizes a door can have, in meters
+    void setDoorSize( float minWidth, float maxWidth,
+                      float minHeight, float maxHeight );
+
+    //lines shorter than minLength meters are not used. A line is upright
+    //or level, and a plane upright, if it is within angleTolerance
+    //degrees of it. A line is on a side of a door if it is within
+    //edgeTolerance meters of it.
+    void setLineLimits( float minLength, float angleTolerance,
+                        float edgeTolerance );
+
+    //candidates with less of their outline on lines are not doors
+    void setMinSupport( float minSupport );
+
+    void setNumThreads( int numThreads );
+
+    //finds the best door on any of the planes. returns false, with the
+    //plane of door set to -1, if there is none.
+    bool detect( const SegmentationResult & planes, door_candidate & door );
+
+private:
+    //a line of a plane in the plane's own frame. Along is the coordinate
+    //that is the same over the whole line, and the line spans from start
+    //to end on the other axis.
+    struct plane_line {
+        float along;
+        float start, end;
+    };
+
+    float fx, fy, u0, v0;
+    float minWidth, maxWidth, minHeight, maxHeight;
+    float minLineLength, angleTolerance, edgeTolerance;
+    float minSupport;
+
+    //caps the candidates of a plane by only using its longest lines
+    static const size_t MAX_LINES = 16;
+
+    TaskGroup planeTasks;
+    std::vector< door_candidate > planeBest;   //the best door of each plane
+
+    //finds the best door of plane p, if it is better than best.
+    void searchPlane( const SegmentationResult & planes, int p,
+                      door_candidate * best ) const;
+
+    //sorts the lines of a plane into upright and level ones.
+    void splitLines( const std::vector< pcl::PointXYZ > & lines,
+                     const Eigen::Vector3f & origin,
+                     const Eigen::Vector3f & across,
+                     const Eigen::Vector3f & up,
+                     std::vector< plane_line > & upright,
+                     std::vector< plane_line > & level ) const;
+
+    //the part of the side at along, from start to end, that lies on lines
+    float sideSupport( const std::vector< plane_line > & lines,
+                       float along, float start, float end ) const;
+
+    //how close a size is to the middle of its range, from 0.5 at the ends
+    //to 1 in the middle.
+    static float sizeScore( float size, float min, float max );
+
+    pcl::PointXYZ toPoint( const Eigen::Vector3f & p ) const;
+    cv::Point toPixel( const Eigen::Vector3f & p ) const;
+};
+
+#endif
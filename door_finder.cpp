@@ -2,7 +2,7 @@
 
 
 void printUsage(){
-    cout << "Usage: ./edge_detector <mode: [1, 3]> <filename>\n"
+    cout << "Usage: ./edge_detector <mode: [1, 4]> <filename>\n"
          << "This program can run with 0, 1, or 2 arguements\n"
          << "With no arguments, this program will not write any data and"
             << " will read data from a device\n"
@@ -12,6 +12,9 @@ void printUsage(){
             << "Point Cloud data to a file\n"
          << "If the first argument is 3, then the program will read "
             << "Point Cloud data from a file\n"
+         << "If the first argument is 4, then the program will replay "
+            << "the Point Cloud data of a file in place of the device, "
+            << "paced as set in the config file\n"
          << "The third argument sets the filename to be read or written to\n";
 }
 
@@ -58,6 +61,11 @@ int main (int argc, char * argv[])
                << v.filename << "\n";
           v.runWithInputFile();
       }
+      else if( value == 4 ){
+          cout << "Running edge detection on a replay of the file: "
+               << v.filename << "\n";
+          v.runReplay();
+      }
       else {
           printUsage();
       }
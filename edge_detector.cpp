@@ -10,6 +10,7 @@
 
 #include <pcl/io/openni_grabber.h>
 #include <pcl/io/pcd_io.h>
+#include <pcl/common/time.h>
 #include <boost/thread/thread.hpp>
 
 
@@ -19,17 +20,51 @@ EdgeDetector::EdgeDetector( const std::string & configFile )
                         pixel_size( 1.075 ),
                         viewerIsInitialized( false ),
                         doWrite( false ), showImage( false ),
-                        u0( -1), v0(-1), config( configFile )
+                        u0( -1), v0(-1), config( configFile ),
+                        spareCaptures( 4 ), spareFrames( 4 ),
+                        stopPipeline( false ), segmentedFrames( 0 ),
+                        reusedFrames( 0 ),
+                        doorsFound( 0 ), doorLatencyUs( 0 ),
+                        frameSequence( 0 ), displayedFrames( 0 ),
+                        cameraIsInitialized( false ),
+                        recordFormat( RecordingWriter::PCD_BINARY ),
+                        recordBufferFrames( 60 ), readIndex( 0 ),
+                        replayReadAhead( 4 ),
+                        replayPacing( ReplayGrabber::REAL_TIME ),
+                        replayRate( 30 ), replayRepeat( false )
 {
+    captureQueue.setSpares( &spareCaptures );
+    resultQueue.setSpares( &spareFrames );
+
     //get the handle parameters
     config.get( "minDistOffPlane", minDistOffPlane );
     config.get( "maxDistOffPlane", maxDistOffPlane );
+    handleFitter.setPlaneOffsets( minDistOffPlane, maxDistOffPlane );
+    config.get( "replayReadAhead", replayReadAhead );
+
+    //get the replay parameters
+    int pacing;
+    config.get( "replayPacing", pacing );
+    replayPacing = ReplayGrabber::Pacing( pacing );
+    config.get( "replayRate", replayRate );
+    replayRepeat = config.getBool( "replayRepeat" );
+
+    //get the recording parameters
+    int format;
+    config.get( "recordFormat", format );
+    recordFormat = RecordingWriter::Format( format );
+    config.get( "recordBufferFrames", recordBufferFrames );
 
     //initialize the segmenter class
     segmenter = PlaneSegmenter( configFile );
+
+    //initialize the door detector
+    doorDetector = DoorDetector( configFile );
+    autoDetectDoor = config.getBool( "autoDetectDoor" );
          
     //the index of the current plane that is being viewed.
     frame_index = 0;
+    renderedPlane = -1;
 
     //the radius of the tag points
     radius = 10;
@@ -52,8 +87,7 @@ EdgeDetector::EdgeDetector( const std::string & configFile )
     view2 = 0;
     line_viewer = new pcl::visualization::PCLVisualizer( "Line Viewer" ) ;
     line_viewer->initCameraParameters();
-    
-    handleIndices = pcl::IndicesPtr ( new std::vector< int > );
+
 
     image_viewer = new pcl::visualization::ImageViewer( "Image Viewer" );
     plane_viewer = new pcl::visualization::ImageViewer( "Plane Viewer" );
@@ -79,32 +113,12 @@ EdgeDetector::EdgeDetector( const std::string & configFile )
 
 pcl::PointXYZ EdgeDetector::projectPoint( int u, int v, int p )
 {
-
-    //extract the coefficients of the plane
-    const float & A = planes[ p ].coeffs.values[0];
-    const float & B = planes[ p ].coeffs.values[1];
-    const float & C = planes[ p ].coeffs.values[2];
-    const float & D = planes[ p ].coeffs.values[3];
-    
     //this corrects for the inversion of the axes in
     //the pcl image viewer point indexing.
     //const int _u = u0 * 2 - u;
     const int _v = v0 * 2 - v;
 
-    const float delta_u = u0 - u;
-    const float delta_v = v0 - _v;
-
-    //These are the analytical solutions for x y and z.
-    //They were solved from the following three equations
-    //      Ax + By + Cz + D = 0
-    //      ( fx * x ) + ( z * delta_u ) = 0 
-    //      ( fy * y ) + ( z * delta_v ) = 0 
-
-    const float z = D / ( A*delta_u/fx + B*delta_v/fy - C );
-    const float x = - delta_u * z / fx;
-    const float y = - delta_v * z / fy;
-
-    return pcl::PointXYZ( x, y, z );
+    return rays.project( planes[ p ].coeffs, u, _v );
 }
 
 int EdgeDetector::addDoorPoint ( int u, int v)
@@ -139,6 +153,23 @@ int EdgeDetector::addDoorPoint ( int u, int v)
     return indexAdded;
 }
 
+void EdgeDetector::setDoor( const door_candidate & door )
+{
+    removeAllDoorLines();
+    doorPoints.clear();
+    drawPoints.clear();
+    frame_index = door.plane;
+    renderedPlane = -1;
+
+    //the image viewer has its v axis upside down
+    for ( int i = 0; i < 4; i ++ ){
+        doorPoints.push_back( door.corners[i] );
+        drawPoints.push_back( Eigen::Vector2i( door.pixels[i].x,
+                                               v0 * 2 - door.pixels[i].y ) );
+    }
+    orderPoints();
+}
+
 //this function uses a left of test to make sure that all of the
 //points are in the correct order.
 void EdgeDetector::orderPoints()
@@ -178,14 +209,9 @@ void EdgeDetector::waitAndDisplay ()
         return;
     }
 
-    frame_index = 0;
     while (this->waiting)
     {
-
-        const cv::Mat & matrix = 
-                planes[ frame_index ].image;
-
-        plane_viewer->showRGBImage( matrix.data, matrix.cols, matrix.rows);
+        showPlaneImage();
         plane_viewer->spinOnce();
     }
     doorPoints.clear();
@@ -193,76 +219,25 @@ void EdgeDetector::waitAndDisplay ()
     removeAllDoorLines();
 }
 
-double EdgeDetector::distanceFromPlane( const pcl::PointXYZRGBA & point,
-                                        const pcl::ModelCoefficients 
-                                        & coeffs ){
-
-    //extract the coefficients of the plane
-    const float & A = planes[ frame_index ].coeffs.values[0];
-    const float & B = planes[ frame_index ].coeffs.values[1];
-    const float & C = planes[ frame_index ].coeffs.values[2];
-    const float & D = planes[ frame_index ].coeffs.values[3];
-    
-    const float numer = A * point.x + B * point.y + C * point.z + D;
-    const float denom = sqrt( A*A + B*B + C*C );
-
-    const float distance = numer / denom;
-
-    if ( distance < 0 )
-    {
-        return -distance;
-    }
-    return distance;
-}
-
-
-void EdgeDetector::getHandlePoints( )
+bool EdgeDetector::getHandlePoints( )
 {
-    cout << "getting handle points\n";
-    if (handle0[1] > handle1[1] ){ std::swap( handle0[1], handle1[1] ); }
-    if (handle0[0] > handle1[0] ){ std::swap( handle0[0], handle1[0] ); }
-    
-    cout << "Assumed cloud size: " << curr_cloud->width * curr_cloud->height;
-    cout << "Cloud Size: " << curr_cloud->points.size() << "\n";
-    for ( int i = handle0[0]; i <= handle1[0] ; i ++ ){
-        for ( int j = handle0[1] ; j <= handle1[1] ; j ++ ){
-            //index through cloud 
-            //the below indexing is invalid
-            const pcl::PointXYZRGBA & p = curr_cloud->at( i, j );
-            const double distance = distanceFromPlane( p,
-                                                 planes[frame_index].coeffs );
-
-            //if the distance is far off the plane, then it is on 
-            if ( distance > minDistOffPlane && distance < maxDistOffPlane )
-            {
-                handleIndices->push_back( j * curr_cloud->width + i );
-            }
-        }
+    if ( handle0[1] > handle1[1] ){ std::swap( handle0[1], handle1[1] ); }
+    if ( handle0[0] > handle1[0] ){ std::swap( handle0[0], handle1[0] ); }
+    if ( frame_index < 0 || frame_index >= planes.size() ){
+        return false;
     }
-    if (handleIndices->size() > 0 ){
-        pcl::PointIndices inliers;
-        
-        pcl::SACSegmentation<Point> sac_seg;
-        sac_seg.setOptimizeCoefficients( true );
-        sac_seg.setInputCloud( curr_cloud->makeShared() );
-        sac_seg.setIndices( handleIndices );
-        sac_seg.setModelType( pcl::SACMODEL_LINE );
-        sac_seg.setMethodType( pcl::SAC_RANSAC );
-        sac_seg.setRadiusLimits( 0, 0.03 );
-        sac_seg.setDistanceThreshold( 0.5 );
-        sac_seg.segment( inliers, handleCoeffs );
-        //sac_seg.segment( , handleCoeffs );
-        
-        handlePos[0] = handleCoeffs.values[0];
-        handlePos[1] = handleCoeffs.values[1];
-        handlePos[2] = handleCoeffs.values[2];
-        
-        handleAxis[0] = handleCoeffs.values[3];
-        handleAxis[1] = handleCoeffs.values[4];
-        handleAxis[2] = handleCoeffs.values[5];
+
+    //the corners are both inside the region
+    const cv::Rect roi( handle0[0], handle0[1],
+                        handle1[0] - handle0[0] + 1,
+                        handle1[1] - handle0[1] + 1 );
+    if ( !handleFitter.fit( *curr_cloud, rays, planes[ frame_index ].coeffs,
+                            roi, handle ) ){
+        return false;
     }
 
     drawHandle();
+    return true;
 }
 
 
@@ -330,32 +305,10 @@ void EdgeDetector::getDoorInfo(double & height, double & width,
 void EdgeDetector::getHandleInfo( double & length, double & height,
                     Eigen::Vector3f & center ){
 
-    Eigen::Vector3f lowerBounds, upperBounds;
-
-    for ( int i = 0; i < handleIndices->size(); i ++ ){
-
-        //get the point on the doorknob
-        const int index = handleIndices->at( i );
-        const Point & currentPoint = curr_cloud->points[ index ];
-
-        if ( currentPoint.x > upperBounds[0] ){ upperBounds[0] = currentPoint.x; }
-        if ( currentPoint.y > upperBounds[1] ){ upperBounds[1] = currentPoint.y; }
-        if ( currentPoint.z > upperBounds[2] ){ upperBounds[2] = currentPoint.z; }
-        
-        if ( currentPoint.x < lowerBounds[0] ){ lowerBounds[0] = currentPoint.x; }
-        if ( currentPoint.y < lowerBounds[1] ){ lowerBounds[1] = currentPoint.y; }
-        if ( currentPoint.z < lowerBounds[2] ){ lowerBounds[2] = currentPoint.z; }
-
-    }
-
-    center = (upperBounds + lowerBounds) / 2;
-
-    const int heightIndex = 1;
-    height = upperBounds[ heightIndex ] - lowerBounds[ heightIndex ];
-
-    const int lengthIndex = 0;
-    length = upperBounds[ lengthIndex ] - lowerBounds[ lengthIndex ];
-
+    //these come out of the pass that found the handle
+    length = handle.length;
+    height = handle.height;
+    center = handle.center;
 }
 
 void EdgeDetector::drawLines ()
@@ -417,8 +370,7 @@ void EdgeDetector::removeAllDoorLines(){
     }
 }
 //create a viewer that holds lines and a point cloud.
-void EdgeDetector::updateViewer( const PointCloud::ConstPtr &cloud,
-                   const std::vector< LinePosArray > & planarLines )
+void EdgeDetector::updateViewer( const PointCloud::ConstPtr &cloud )
 {
     //remove the shapes so that they can be updated.
     line_viewer->removeAllShapes( view1);
@@ -428,23 +380,28 @@ void EdgeDetector::updateViewer( const PointCloud::ConstPtr &cloud,
     //print out the number of planes.
     cout << "Number of Planes: " << planes.size() << endl;
 
-    //Display all of the edge lines in the line_viewer.
-    for( int i = 0; i < planarLines.size(); i ++ ){
-        const LinePosArray lines = planarLines[i];
-
-        //The every two points constitute a lines (two endpoints)
-        for ( int j = 0; j < lines.size() ; j += 2 ){
-            const pcl::PointXYZ start = lines[ j ];
-            const pcl::PointXYZ end   = lines[ j+1 ];
-            
-            cv::Vec3i color = colors[ (i / 2) % colors.size() ];
-            if ( i % 2 == 1 ){
-                color *= 0.2;
+    //Display all of the edge lines in the line_viewer. The intensity
+    //lines are drawn in a darker shade of the plane's color.
+    for( int i = 0; i < planes.size(); i ++ ){
+        for ( int k = 0; k < 2; k ++ ){
+            const LinePosArray & lines = k == 0 ? planes[i].depthLines
+                                                : planes[i].intensityLines;
+            const int slot = 2 * i + k;
+
+            //The every two points constitute a lines (two endpoints)
+            for ( int j = 0; j + 1 < lines.size() ; j += 2 ){
+                const pcl::PointXYZ & start = lines[ j ];
+                const pcl::PointXYZ & end   = lines[ j+1 ];
+
+                cv::Vec3i color = colors[ i % colors.size() ];
+                if ( k == 1 ){
+                    color *= 0.2;
+                }
+                line_viewer->addLine(start, end,
+                                color[0], color[1], color[2],
+                                "line" +  boost::to_string( j*100 + slot ),
+                                 view1 );
             }
-            line_viewer->addLine(start, end,
-                            color[0], color[1], color[2],
-                            "line" +  boost::to_string( j*100 +i ),
-                             view1 );
         }
     }
     line_viewer->spinOnce (100);
@@ -452,30 +409,24 @@ void EdgeDetector::updateViewer( const PointCloud::ConstPtr &cloud,
 
 void EdgeDetector::drawHandle(){
 
-    cout << "handlePoints Size: " << handleIndices->size() << endl;
-    for ( int i = 0; i < 40 && i < handleIndices->size(); i ++ ){
-        const int a = rand() % handleIndices->size();
-        const int b = rand() % handleIndices->size();
+    const pcl::PointCloud< pcl::PointXYZ > & points = *handle.points;
+    cout << "handlePoints Size: " << points.size() << endl;
+    for ( int i = 0; i < 40 && i < points.size(); i ++ ){
+        const int a = rand() % points.size();
+        const int b = rand() % points.size();
 
-        const Point & p0 = curr_cloud->points[ handleIndices->at( a ) ];
-        const Point & p1 = curr_cloud->points[ handleIndices->at( b ) ];
-        
-        line_viewer->addLine(p0, p1, 0, 0, 255,
+        line_viewer->addLine( points[a], points[b], 0, 0, 255,
                             "handleSecond" +  boost::to_string( i ),
                              view1 );
-
-
-        cout << "added handle lines" << endl;
-    
     }
-    line_viewer->addLine( handleCoeffs, "handle", view1 );
+    line_viewer->addLine( handle.coeffs, "handle", view1 );
 
     line_viewer->spinOnce (100);
 }
 
 
-//initialize point cloud viewer
-void EdgeDetector::initViewer( const PointCloud::ConstPtr & cloud )
+//set the camera intrinsics from the size of the cloud
+void EdgeDetector::initCamera( const PointCloud::ConstPtr & cloud )
 {
 
     // set the intrinsics for the camera. This is necessary for 
@@ -486,6 +437,20 @@ void EdgeDetector::initViewer( const PointCloud::ConstPtr & cloud )
     fx = deviceFocalLength;
     fy = deviceFocalLength;
     segmenter.setCameraIntrinsics( fx, fy, u0, v0 );
+    doorDetector.setCameraIntrinsics( fx, fy, u0, v0 );
+    rays.setIntrinsics( fx, fy, u0, v0 );
+    rays.setSize( cloud->width, cloud->height );
+
+    cameraIsInitialized = true;
+}
+
+//initialize point cloud viewer
+void EdgeDetector::initViewer( const PointCloud::ConstPtr & cloud )
+{
+
+    if ( !cameraIsInitialized ){
+        initCamera( cloud );
+    }
 
     //set up the color handler for the point cloud viewer. this will
     //enable showing color
@@ -526,49 +491,271 @@ void EdgeDetector::run()
 
 #ifndef __APPLE__ 
     pcl::OpenNIGrabber* interface = new pcl::OpenNIGrabber();
+
+    fx = interface->getDevice()->getDepthFocalLength() / pixel_size;
+    fy = fx;
+
+    runGrabber( *interface );
+#endif
+}
+
+void EdgeDetector::runReplay()
+{
+    ReplayGrabber replay;
+    replay.setPacing( replayPacing, replayRate );
+    replay.setRepeat( replayRepeat );
+    replay.setReadAhead( replayReadAhead );
+    if ( !replay.open( filename ) ){
+        exit(-1);
+    }
+
+    runGrabber( replay );
+    replay.printCounters( cout );
+}
+
+void EdgeDetector::runGrabber( pcl::Grabber & interface )
+{
     boost::function<
         void (const PointCloud::ConstPtr&)> f =
         boost::bind (&EdgeDetector::cloud_cb_, this, _1);
-    interface->registerCallback (f);
+    interface.registerCallback (f);
 
-    fx = interface->getDevice()->getDepthFocalLength() / pixel_size;
-    fy = fx;
+    if ( doWrite && !recorder.start( filename, recordFormat,
+                                     recordBufferFrames ) ){
+        exit(-1);
+    }
 
+    //the image viewer lives on this thread, so the segmenter draws the
+    //picture of the lines into each result instead
+    segmenter.setLineImage( true );
 
-    interface->start ();
+    stopPipeline = false;
+    boost::thread segmentThread( boost::bind( &EdgeDetector::segmentLoop,
+                                              this ) );
 
-    while (!line_viewer->wasStopped())
+    interface.start ();
+
+    while ( !line_viewer->wasStopped() && interface.isRunning() )
     {
-        boost::this_thread::sleep (boost::posix_time::seconds (1));
+        displayOnce();
     }
 
-    interface->stop();
+    interface.stop();
 
-#endif
+    //the last frames of a replay are still in the queues when it ends
+    while ( !line_viewer->wasStopped() && !pipelineIsDrained() )
+    {
+        displayOnce();
+    }
+
+    //write out the frames that are still waiting
+    recorder.stop();
+
+    stopPipeline = true;
+    segmentThread.join();
+    printPipelineCounters( cout );
 }
 
-//point cloud callback function gets new pointcloud and runs segmentation
-//algorithm
+//point cloud callback function gets new pointcloud and hands it to the
+//segmentation stage. This runs on the grabber thread, so it must never
+//wait on the later stages.
 void EdgeDetector::cloud_cb_ (const PointCloud::ConstPtr &cloud)
 {
-    curr_cloud = cloud;
-    if ( !viewerIsInitialized ){
-        initViewer( cloud );
+    if ( doWrite ){
+        recorder.push( cloud );
+    }
+
+    captured_frame * frame = spareCaptures.pop();
+    if ( frame == NULL ){
+        frame = new captured_frame;
     }
+    frame->cloud = cloud;
+    frame->sequence = frameSequence ++;
+    frame->arrival = pcl::getTime();
+    captureQueue.push( frame );
+}
 
-    if ( !line_viewer->wasStopped() ){
-        planes.clear();
-        std::vector< LinePosArray > planarLines;
-        if ( doWrite ){
-            savePointCloud( *cloud );
+//the segmentation stage always works on the newest captured frame, any
+//frame that arrives while it is busy replaces the one waiting before it.
+void EdgeDetector::segmentLoop()
+{
+    while ( !stopPipeline ){
+        captured_frame * frame = captureQueue.waitPop( 0.1 );
+        if ( frame == NULL ){
+            continue;
+        }
+
+        if ( !cameraIsInitialized ){
+            initCamera( frame->cloud );
+        }
+
+        segmented_frame * result = spareFrames.pop();
+        if ( result == NULL ){
+            result = new segmented_frame;
+        }
+        result->cloud = frame->cloud;
+        result->sequence = frame->sequence;
+        result->door.plane = -1;
+
+        if ( !doWrite ){
+            segmenter.segment( result->cloud, result->result );
+            if ( result->result.isReused() ){
+                reusedFrames ++;
+            }
+
+            if ( autoDetectDoor &&
+                 doorDetector.detect( result->result, result->door ) ){
+                doorsFound ++;
+                doorLatencyUs += ( unsigned long )(
+                            ( pcl::getTime() - frame->arrival ) * 1e6 );
+            }
+            segmentedFrames ++;
         } else {
-            
-            segmenter.segment( cloud, planes, planarLines, image_viewer );
+            //a spare frame still has the planes it was last shown with
+            result->result.clear();
+            result->result.getLineImage().release();
         }
-        updateViewer( cloud, planarLines );
+        frame->cloud.reset();
+        spareCaptures.push( frame );
+        resultQueue.push( result );
+    }
+}
+
+bool EdgeDetector::pipelineIsDrained() const
+{
+    //every frame the segment stage takes out of the capture queue comes
+    //out of it into the result queue
+    return captureQueue.popped() + captureQueue.dropped() >=
+                                                    captureQueue.pushed() &&
+           resultQueue.pushed() >= captureQueue.popped() &&
+           resultQueue.popped() + resultQueue.dropped() >=
+                                                    resultQueue.pushed();
+}
+
+void EdgeDetector::displayOnce()
+{
+    //while the user is paused on a frame, the newer results are left in
+    //the queue, where they replace each other.
+    if ( !waiting || planes.empty() ){
+        segmented_frame * frame = resultQueue.waitPop( 0.03 );
+        if ( frame != NULL ){
+            showResult( *frame );
+            spareFrames.push( frame );
+        }
+    }
+
+    if ( !viewerIsInitialized ){
+        return;
+    }
+
+    showPlaneImage();
+    plane_viewer->spinOnce();
+    image_viewer->spinOnce();
+    line_viewer->spinOnce();
+}
+
+void EdgeDetector::showResult( segmented_frame & frame )
+{
+    if ( !viewerIsInitialized ){
+        initViewer( frame.cloud );
+    }
+
+    removeAllDoorLines();
+    doorPoints.clear();
+    drawPoints.clear();
+
+    curr_cloud = frame.cloud;
+    planes.swap( frame.result );
+    frame_index = 0;
+    renderedPlane = -1;
+
+    //the viewer is updated first, since it clears the door and handle
+    //lines
+    updateViewer( curr_cloud );
+    const cv::Mat & lineImage = planes.getLineImage();
+    if ( !lineImage.empty() ){
+        image_viewer->showRGBImage( lineImage.data, lineImage.cols,
+                                    lineImage.rows );
+    }
+    if ( frame.door.plane >= 0 ){
+        setDoor( frame.door );
+        drawLines();
+    }
+    if ( handle1[0] >= 0 ){
+        getHandlePoints();
+    }
+    displayedFrames ++;
+}
+
+//shows the plane being viewed, drawing its picture only when it changes
+void EdgeDetector::showPlaneImage()
+{
+    if ( frame_index < 0 || frame_index >= planes.size() ){
+        return;
+    }
+    if ( renderedPlane != frame_index ){
+        PlaneSegmenter::renderPlane( planes[ frame_index ], *curr_cloud,
+                                     planeImage );
+        renderedPlane = frame_index;
+    }
+    plane_viewer->showRGBImage( planeImage.data, planeImage.cols,
+                                planeImage.rows );
+}
+
+//looks the plane up in the label image of the frame
+int EdgeDetector::planeAt( int u, int v ) const
+{
+    if ( planes.empty() ){
+        return -1;
+    }
+    const cv::Mat & labels = planes[0].labels;
+
+    //this corrects for the inversion of the axes in
+    //the pcl image viewer point indexing.
+    const int _v = v0 * 2 - v;
+    if ( u < 0 || u >= labels.cols || _v < 0 || _v >= labels.rows ){
+        return -1;
+    }
+
+    const int label = labels.at< uint8_t >( _v, u );
+    if ( label == LabelMask::UNCLAIMED || label > planes.size() ||
+         planes[ label - 1 ].label != label ){
+        return -1;
+    }
+    return label - 1;
+}
+
+EdgeDetector::pipeline_counters EdgeDetector::getPipelineCounters() const
+{
+    pipeline_counters counters;
+    counters.captured = captureQueue.pushed();
+    counters.captureDropped = captureQueue.dropped();
+    counters.segmented = segmentedFrames;
+    counters.reused = reusedFrames;
+    counters.resultDropped = resultQueue.dropped();
+    counters.displayed = displayedFrames;
+    counters.doorsFound = doorsFound;
+    counters.meanDoorLatency = counters.doorsFound > 0 ?
+                    doorLatencyUs * 1e-6 / counters.doorsFound : 0;
+    return counters;
+}
+
+void EdgeDetector::printPipelineCounters( std::ostream & ostr ) const
+{
+    const pipeline_counters c = getPipelineCounters();
+    ostr << "frames captured: " << c.captured
+         << " (" << c.captureDropped << " dropped before segmentation)\n"
+         << "frames segmented: " << c.segmented
+         << " (" << c.reused << " unchanged and reused, "
+         << c.resultDropped << " dropped before display)\n"
+         << "frames displayed: " << c.displayed << "\n";
+    if ( autoDetectDoor ){
+        ostr << "doors found: " << c.doorsFound << " ("
+             << c.meanDoorLatency * 1000 << " ms from capture on average)\n";
+    }
+    if ( doWrite ){
+        recorder.printCounters( ostr );
     }
-    waitAndDisplay();
-    cout << "ended Call back\n";
 }
 
 //this program will run until the reader throws an error about 
@@ -578,7 +765,6 @@ void EdgeDetector::runWithInputFile()
     while ( true ){
         if ( !line_viewer->wasStopped() ){
             planes.clear();
-            std::vector< LinePosArray > planarLines;
             PointCloud::Ptr cloud (new PointCloud );
             readPointCloud( cloud );
             curr_cloud = cloud;
@@ -587,44 +773,69 @@ void EdgeDetector::runWithInputFile()
                 initViewer( cloud );
             }
 
-            segmenter.segment( cloud, planes, planarLines, image_viewer );
-            updateViewer( cloud, planarLines );
+            segmenter.segment( cloud, planes, image_viewer );
+            frame_index = 0;
+            renderedPlane = -1;
+            updateViewer( cloud );
+
+            door_candidate door;
+            if ( autoDetectDoor && doorDetector.detect( planes, door ) ){
+                setDoor( door );
+                drawLines();
+            }
+            if ( handle1[0] >= 0 ){
+                getHandlePoints();
+            }
         }  
         waitAndDisplay();        
     }
 
 }
 
-//aves pcd files from grabbed pointclouds
-void EdgeDetector::savePointCloud(const PointCloud & cloud)
-{
-    static int index = 0;
-
-    pcl::io::savePCDFileBinary(filename + 
-                               boost::to_string( index ) + ".pcd"
-                               , cloud);
-    index ++;
-    cout << "Saving point cloud number: " << index << "\n";
-}
-
-//reads existing pcd files
+//reads existing pcd files, or the frames of a frame file
 void EdgeDetector::readPointCloud(PointCloud::Ptr & cloud)
 {
-    static int index = 0;
+    const std::string extension = ".frames";
+    const bool isFrameFile = filename.size() > extension.size() &&
+        filename.compare( filename.size() - extension.size(),
+                          extension.size(), extension ) == 0;
+
+    if ( isFrameFile ){
+        //the frames after the one being shown are decoded ahead of time
+        if ( readIndex == 0 ){
+            frameFile.setReadAhead( replayReadAhead );
+            if ( !frameFile.open( filename ) ){
+                exit(-1);
+            }
+        }
+        if ( readIndex >= frameFile.numFrames() ){
+            cerr << "No more frames in " << filename << endl;
+            exit(-1);
+        }
+        cloud = frameFile.get( readIndex );
+        if ( !cloud ){
+            cerr << "Couldn't read frame " << readIndex << " of "
+                 << filename << endl;
+            exit(-1);
+        }
+        readIndex ++;
+        return;
+    }
+
     try {
         if (pcl::io::loadPCDFile<Point> (filename + 
-                                         boost::to_string( index )
+                                         boost::to_string( readIndex )
                                          +".pcd", *cloud) == -1)
         {
             cerr << "Couldn't read file "+filename+
-                     boost::to_string( index ) +".pcd" << endl;
+                     boost::to_string( readIndex ) +".pcd" << endl;
             exit(-1);
         }
     }
     catch (std::exception &e){
         cout << "Error reading pcd file" << e.what() << endl;
     }
-    index ++;
+    readIndex ++;
 }
 
 
@@ -649,9 +860,8 @@ inline void EdgeDetector::convertColor( PointCloud::Ptr & cloud,
 
 
 
-//mouse click callback- currently prints out location of mouse click
-//on viewer
-//TODO: return plane that mouse click location is a member of
+//mouse click callback- places and moves the door points. The first door
+//point picks the plane under it as the plane being viewed.
 void mouseClick(const pcl::visualization::MouseEvent &event,
                     void* detector)
 {  
@@ -684,6 +894,14 @@ void mouseClick(const pcl::visualization::MouseEvent &event,
                    }
                 }
                 if (index < 0 ){
+                    if ( detect->doorPoints.empty() ){
+                        const int plane = detect->planeAt( event.getX(),
+                                                           event.getY() );
+                        if ( plane >= 0 && plane != detect->frame_index ){
+                            cout << "Switching to plane " << plane << "\n";
+                            detect->frame_index = plane;
+                        }
+                    }
                     detect->addDoorPoint( event.getX() , event.getY() );
                 }
             }
@@ -13,12 +13,17 @@
 #include <pcl/console/parse.h>
 
 #include "plane_segmenter.h"
+#include "frame_queue.h"
+#include "frame_file.h"
+#include "recording_writer.h"
+#include "replay_grabber.h"
+#include "door_detector.h"
+#include "handle_fitter.h"
 
 #include "SimpleConfig.h"
 
 
-//mouse click callback- currently prints out location of mouse click
-//on viewer
+//mouse click callback- places and moves the door points on the viewer
 void mouseClick(const pcl::visualization::MouseEvent &event, void* detector);
 
 
@@ -46,34 +51,46 @@ public:
     double radius, minDistOffPlane, maxDistOffPlane;
 
     float fx, fy, u0, v0;
+    RayTable rays;    //the rays of the pixels, for projectPoint
     bool waiting;
 
     int current_grasp_index;
 
-    Eigen::Vector3f handlePos;
-    Eigen::Vector3f handleAxis;
     double handleRadius;
 
+    //the corners of the region the handle is in, in image pixels, and
+    //the handle found in it. Once both are set the handle is found again
+    //in every frame.
     Eigen::Vector2i handle0, handle1;
+    handle_data handle;
 
     //these hold information on the current plane 
     //segmented picture.
     PointCloud::ConstPtr curr_cloud;
-    std::vector<plane_data> planes;
+    SegmentationResult planes;
 
     int frame_index;    //the index of the plane currently
                         //being viewed
     //the xyz points of the corners of the doors in 3D space
     std::vector< pcl::PointXYZ > doorPoints;
-    pcl::IndicesPtr handleIndices;
-
-    pcl::ModelCoefficients handleCoeffs;
 
     //the u, v points of the corners of the doors in 
     //the picture plane
     std::vector< Eigen::Vector2i > drawPoints;
 
 
+    //counts of the frames that went through the stages of the live
+    //pipeline. A frame is dropped when a newer one replaces it before the
+    //next stage gets to it.
+    struct pipeline_counters {
+        unsigned long captured, captureDropped;
+        unsigned long segmented, resultDropped;
+        unsigned long reused;     //segmented frames that had not changed
+        unsigned long displayed;
+        unsigned long doorsFound;
+        double meanDoorLatency;   //seconds from capture to door pose
+    };
+
     //a simple constructor using a config file.
     EdgeDetector ( const std::string & configFile );
 
@@ -81,9 +98,20 @@ public:
     //a non-existant file.
     void runWithInputFile();
 
-    //run with input from the camera
+    //run with input from the camera. The frames are captured on the
+    //grabber thread, segmented on a thread of their own and displayed on
+    //this thread, so a slow viewer never holds up the segmentation.
     void run ();
 
+    //run the live pipeline on a recording played back in place of the
+    //camera, paced as set by replayPacing and replayRate in the config.
+    //It stops at the end of the recording and prints how many frames
+    //each stage dropped.
+    void runReplay();
+
+    pipeline_counters getPipelineCounters() const;
+    void printPipelineCounters( std::ostream & ostr ) const;
+
     //the doorPos is the position of the center of the door,
     void getDoorInfo(double & height, double & width,
                      Eigen::Vector3f & doorPos, 
@@ -105,20 +133,55 @@ public:
     void drawHandle();
     pcl::PointXYZ projectPoint( int u, int v, int p );
 
+    //returns the index of the plane under a point of the plane viewer,
+    //or -1 if it is not on a plane.
+    int planeAt( int u, int v ) const;
+
+    //puts the door points on the corners of a door that was found
+    //without clicks, and shows its plane.
+    void setDoor( const door_candidate & door );
+
     //if the points do not follow a counter clockwise ordering,
     //reorder them so that they do.
     void orderPoints();
 
 
-    void getHandlePoints();
-    double distanceFromPlane( const pcl::PointXYZRGBA & point,
-                              const pcl::ModelCoefficients & coeffs);
+    //finds the handle between handle0 and handle1, off the plane being
+    //viewed. returns false if it is not there.
+    bool getHandlePoints();
     
 
 
 private:
     SimpleConfig config;
 
+    //a frame on its way from the grabber to the segmenter
+    struct captured_frame {
+        PointCloud::ConstPtr cloud;
+        unsigned long sequence;
+        double arrival;     //pcl::getTime when the grabber handed it over
+    };
+
+    //a frame on its way from the segmenter to the viewer
+    struct segmented_frame {
+        PointCloud::ConstPtr cloud;
+        SegmentationResult result;
+        door_candidate door;
+        unsigned long sequence;
+    };
+
+    //the stages of the live pipeline are connected by these. Each one
+    //only holds the newest frame. The frames that were used or dropped go
+    //back to the stage that fills them through the spares, so the frames
+    //and the buffers of their results are reused.
+    FrameQueue< captured_frame > captureQueue, spareCaptures;
+    FrameQueue< segmented_frame > resultQueue, spareFrames;
+    boost::atomic< bool > stopPipeline;
+    boost::atomic< unsigned long > segmentedFrames, reusedFrames;
+    boost::atomic< unsigned long > doorsFound, doorLatencyUs;
+    unsigned long frameSequence, displayedFrames;
+    bool cameraIsInitialized;
+
 
     //this holds a set of colors for visualization
     std::vector< cv::Vec3i > colors;
@@ -130,12 +193,46 @@ private:
 
     PlaneSegmenter segmenter;
 
+    //finds the door in the lines of the planes, when autoDetectDoor is set
+    DoorDetector doorDetector;
+    bool autoDetectDoor;
+
+    HandleFitter handleFitter;
+
+    //the picture of the plane being viewed, and which plane it is of.
+    //-1 means it has to be drawn again.
+    cv::Mat planeImage;
+    int renderedPlane;
+
 
     //create a viewer that holds lines and a point cloud.
-    void updateViewer( const PointCloud::ConstPtr &cloud,
-                       const std::vector< LinePosArray > & planarLines );
+    void updateViewer( const PointCloud::ConstPtr &cloud );
 
     void initViewer( const PointCloud::ConstPtr & cloud );
+
+    //sets the camera intrinsics from the first cloud.
+    void initCamera( const PointCloud::ConstPtr & cloud );
+
+    //runs the live pipeline on the frames of a grabber, until the viewer
+    //is closed or the grabber stops. The frames the grabber handed over
+    //before it stopped are still segmented and shown.
+    void runGrabber( pcl::Grabber & interface );
+
+    //the segmentation stage of the live pipeline.
+    void segmentLoop();
+
+    //true once every captured frame has been segmented or dropped, and
+    //every segmented frame shown or dropped. Only meaningful once the
+    //grabber has stopped.
+    bool pipelineIsDrained() const;
+
+    //one pass of the display stage of the live pipeline. It takes the
+    //newest segmented frame, unless the user paused on the current one.
+    void displayOnce();
+    void showResult( segmented_frame & frame );
+
+    //shows the plane being viewed in the plane viewer.
+    void showPlaneImage();
     
 
 
@@ -143,8 +240,8 @@ private:
     //points that fail the left-of test.
     void left_of_switch( const int index1, const int index2, const int index3 );
 
-    //point cloud callback function gets new pointcloud and runs segmentation
-    //algorithm
+    //point cloud callback function gets new pointcloud and hands it to the
+    //segmentation stage
     void cloud_cb_ (const PointCloud::ConstPtr &cloud);
 
     //This is the main door specifying event loop.
@@ -153,12 +250,25 @@ private:
     //clear the plane viewer of the lines.
     void removeAllDoorLines();
 
-    //saves pcd files from grabbed pointclouds
-    void savePointCloud(const PointCloud & cloud);
+    //saves the grabbed point clouds in write mode, off the grabber thread
+    RecordingWriter recorder;
+    RecordingWriter::Format recordFormat;
+    int recordBufferFrames;
 
-    //reads existing pcd files
+    //reads the next frame of a recording. A filename ending in .frames is
+    //a frame file, anything else is the prefix of a sequence of pcd files.
     void readPointCloud(PointCloud::Ptr & cloud);
 
+    //the recording being replayed, and the next frame to read from it
+    FrameFileReader frameFile;
+    int readIndex;
+    int replayReadAhead;
+
+    //how runReplay paces the frames
+    ReplayGrabber::Pacing replayPacing;
+    double replayRate;
+    bool replayRepeat;
+
     //a utility function to change the color of a point cloud.
     //this is currently unused.
     inline void convertColor( PointCloud::Ptr & cloud,
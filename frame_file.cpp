@@ -0,0 +1,576 @@
+#include "frame_file.h"
+
+#include <algorithm>
+#include <iostream>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <pcl/io/lzf.h>
+
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/static_assert.hpp>
+#include <boost/exception/to_string.hpp>
+
+//the layout of the file depends on these sizes
+BOOST_STATIC_ASSERT( sizeof( float ) == 4 );
+BOOST_STATIC_ASSERT( sizeof( frame_file_header ) == 32 );
+BOOST_STATIC_ASSERT( sizeof( frame_record_header ) == 32 );
+BOOST_STATIC_ASSERT( sizeof( frame_index_entry ) == 16 );
+
+//the fields are put in and taken out byte by byte, so the file is
+//little-endian on any host.
+static inline void put32( unsigned char * p, boost::uint32_t value )
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+static inline void put64( unsigned char * p, boost::uint64_t value )
+{
+    put32( p, boost::uint32_t( value ) );
+    put32( p + 4, boost::uint32_t( value >> 32 ) );
+}
+
+static inline void putFloat( unsigned char * p, float value )
+{
+    boost::uint32_t bits;
+    memcpy( &bits, &value, 4 );
+    put32( p, bits );
+}
+
+static inline boost::uint32_t get32( const unsigned char * p )
+{
+    return boost::uint32_t( p[0] ) | ( boost::uint32_t( p[1] ) << 8 ) |
+           ( boost::uint32_t( p[2] ) << 16 ) | ( boost::uint32_t( p[3] ) << 24 );
+}
+
+static inline boost::uint64_t get64( const unsigned char * p )
+{
+    return boost::uint64_t( get32( p ) ) |
+           ( boost::uint64_t( get32( p + 4 ) ) << 32 );
+}
+
+static inline float getFloat( const unsigned char * p )
+{
+    const boost::uint32_t bits = get32( p );
+    float value;
+    memcpy( &value, &bits, 4 );
+    return value;
+}
+
+static inline boost::uint64_t padded( boost::uint64_t size )
+{
+    return ( size + 7 ) & ~boost::uint64_t( 7 );
+}
+
+//returns the number at the end of a file name ( drexel12.pcd -> 12 ),
+//or -1 if the name does not end in a number.
+static long frameNumber( const std::string & path )
+{
+    const std::string stem = boost::filesystem::path( path ).stem().string();
+    size_t p = stem.size();
+    while ( p > 0 && isdigit( stem[p-1] ) ){ p --; }
+    if ( p == stem.size() ){
+        return -1;
+    }
+    return atol( stem.c_str() + p );
+}
+
+static bool frameOrder( const std::string & a, const std::string & b )
+{
+    const long na = frameNumber( a );
+    const long nb = frameNumber( b );
+    if ( na != nb ){
+        return na < nb;
+    }
+    return a < b;
+}
+
+void frame_file::listPcdFiles( const std::string & input,
+                               std::vector< std::string > & files )
+{
+    namespace fs = boost::filesystem;
+
+    if ( fs::is_directory( input ) ){
+        for ( fs::directory_iterator i( input ); i != fs::directory_iterator();
+              ++ i ){
+            if ( fs::is_regular_file( i->status() ) &&
+                 i->path().extension() == ".pcd" ){
+                files.push_back( i->path().string() );
+            }
+        }
+        std::sort( files.begin(), files.end(), frameOrder );
+    } else {
+        for ( int index = 0; ; index ++ ){
+            const std::string file = input + boost::to_string( index ) + ".pcd";
+            if ( !fs::exists( file ) ){
+                break;
+            }
+            files.push_back( file );
+        }
+    }
+}
+
+void frame_file::pcdTimestamps( const std::vector< std::string > & files,
+                                std::vector< boost::uint64_t > & timestamps,
+                                double frameInterval )
+{
+    timestamps.resize( files.size() );
+    for ( size_t i = 0; i < files.size(); i ++ ){
+        struct stat info;
+        if ( stat( files[i].c_str(), &info ) != 0 ){
+            timestamps[i] = 0;
+            continue;
+        }
+#ifdef __APPLE__
+        const struct timespec & modified = info.st_mtimespec;
+#else
+        const struct timespec & modified = info.st_mtim;
+#endif
+        timestamps[i] = boost::uint64_t( modified.tv_sec ) * 1000000 +
+                        modified.tv_nsec / 1000;
+    }
+
+    //a file that was touched after it was recorded can not move its frame
+    //back in time
+    for ( size_t i = 1; i < timestamps.size(); i ++ ){
+        timestamps[i] = std::max( timestamps[i], timestamps[i-1] );
+    }
+
+    for ( size_t i = 0; i < timestamps.size(); ){
+        size_t j = i + 1;
+        while ( j < timestamps.size() && timestamps[j] == timestamps[i] ){
+            j ++;
+        }
+        const double step = j < timestamps.size() ?
+            double( timestamps[j] - timestamps[i] ) / ( j - i ) : frameInterval;
+        for ( size_t k = i + 1; k < j; k ++ ){
+            timestamps[k] = timestamps[i] + boost::uint64_t( ( k - i ) * step );
+        }
+        i = j;
+    }
+}
+
+
+FrameFileWriter::FrameFileWriter() : file( NULL ),
+                                     compression( frame_file::NONE ),
+                                     offset( 0 )
+{
+}
+
+FrameFileWriter::~FrameFileWriter()
+{
+    close();
+}
+
+bool FrameFileWriter::open( const std::string & fileName,
+                            frame_file::Compression compression )
+{
+    close();
+    file = fopen( fileName.c_str(), "wb" );
+    if ( file == NULL ){
+        return false;
+    }
+    this->compression = compression;
+    index.clear();
+
+    //the index offset and frame count are filled in by close
+    header.assign( sizeof( frame_file_header ), 0 );
+    memcpy( &header[0], frame_file::FILE_MAGIC, 8 );
+    put32( &header[8], frame_file::VERSION );
+    put32( &header[12], sizeof( frame_file_header ) );
+    if ( fwrite( &header[0], 1, header.size(), file ) != header.size() ){
+        fclose( file );
+        file = NULL;
+        return false;
+    }
+    offset = header.size();
+    return true;
+}
+
+void FrameFileWriter::close()
+{
+    if ( file == NULL ){
+        return;
+    }
+
+    std::vector< unsigned char > table( index.size() *
+                                        sizeof( frame_index_entry ) );
+    for ( size_t i = 0; i < index.size(); i ++ ){
+        unsigned char * p = &table[ i * sizeof( frame_index_entry ) ];
+        put64( p, index[i].offset );
+        put64( p + 8, index[i].timestamp );
+    }
+    bool ok = table.empty() ||
+              fwrite( &table[0], 1, table.size(), file ) == table.size();
+
+    //the index is only pointed to once it has been written, so a file
+    //that was cut short is still read by hopping over its records.
+    if ( ok ){
+        unsigned char tail[16];
+        put64( tail, offset );
+        put32( tail + 8, index.size() );
+        put32( tail + 12, 0 );
+        ok = fseek( file, 16, SEEK_SET ) == 0 &&
+             fwrite( tail, 1, sizeof( tail ), file ) == sizeof( tail );
+    }
+    if ( !ok ){
+        std::cerr << "error writing the frame index\n";
+    }
+
+    fclose( file );
+    file = NULL;
+}
+
+bool FrameFileWriter::write( const PointCloud & cloud,
+                             boost::uint64_t timestamp )
+{
+    if ( file == NULL ){
+        return false;
+    }
+
+    //lay the points out field by field
+    const size_t numPoints = cloud.points.size();
+    fields.resize( numPoints * frame_file::POINT_SIZE );
+    unsigned char * xs = fields.empty() ? NULL : &fields[0];
+    unsigned char * ys = xs + 4 * numPoints;
+    unsigned char * zs = ys + 4 * numPoints;
+    unsigned char * colors = zs + 4 * numPoints;
+    for ( size_t i = 0; i < numPoints; i ++ ){
+        const Point & p = cloud.points[i];
+        putFloat( xs + 4 * i, p.x );
+        putFloat( ys + 4 * i, p.y );
+        putFloat( zs + 4 * i, p.z );
+        put32( colors + 4 * i, p.rgba );
+    }
+
+    //a frame that lzf can not make smaller is stored as it is.
+    boost::uint32_t frameCompression = frame_file::NONE;
+    const unsigned char * stored = xs;
+    size_t storedSize = fields.size();
+    if ( compression == frame_file::LZF && !fields.empty() ){
+        packed.resize( fields.size() );
+        const unsigned int packedSize = pcl::lzfCompress( &fields[0],
+                                                          fields.size(),
+                                                          &packed[0],
+                                                          packed.size() );
+        if ( packedSize > 0 ){
+            frameCompression = frame_file::LZF;
+            stored = &packed[0];
+            storedSize = packedSize;
+        }
+    }
+
+    unsigned char record[ sizeof( frame_record_header ) ];
+    put32( record, frame_file::FRAME_MAGIC );
+    put32( record + 4, frameCompression );
+    put32( record + 8, cloud.width );
+    put32( record + 12, cloud.height );
+    put64( record + 16, timestamp );
+    put64( record + 24, storedSize );
+
+    const unsigned char zeros[8] = { 0 };
+    const size_t padding = padded( storedSize ) - storedSize;
+    if ( fwrite( record, 1, sizeof( record ), file ) != sizeof( record ) ||
+         ( storedSize > 0 &&
+           fwrite( stored, 1, storedSize, file ) != storedSize ) ||
+         fwrite( zeros, 1, padding, file ) != padding ){
+        return false;
+    }
+
+    frame_index_entry entry;
+    entry.offset = offset;
+    entry.timestamp = timestamp;
+    index.push_back( entry );
+    offset += sizeof( record ) + storedSize + padding;
+    return true;
+}
+
+
+FrameFileReader::FrameFileReader() : data( NULL ), length( 0 ),
+                                     readAhead( 0 ), nextFrame( 0 ),
+                                     stopping( false )
+{
+}
+
+FrameFileReader::~FrameFileReader()
+{
+    close();
+}
+
+bool FrameFileReader::open( const std::string & fileName )
+{
+    close();
+
+    const int fd = ::open( fileName.c_str(), O_RDONLY );
+    if ( fd < 0 ){
+        std::cerr << "error opening " << fileName << "\n";
+        return false;
+    }
+    struct stat info;
+    if ( fstat( fd, &info ) != 0 ||
+         size_t( info.st_size ) < sizeof( frame_file_header ) ){
+        std::cerr << fileName << " is not a frame file\n";
+        ::close( fd );
+        return false;
+    }
+    length = info.st_size;
+    void * mapping = mmap( NULL, length, PROT_READ, MAP_SHARED, fd, 0 );
+    ::close( fd );
+    if ( mapping == MAP_FAILED ){
+        std::cerr << "error mapping " << fileName << "\n";
+        length = 0;
+        return false;
+    }
+    data = static_cast< const unsigned char * >( mapping );
+
+    frame_file_header header;
+    memcpy( header.magic, data, 8 );
+    header.version = get32( data + 8 );
+    header.headerSize = get32( data + 12 );
+    header.indexOffset = get64( data + 16 );
+    header.numFrames = get32( data + 24 );
+    if ( memcmp( header.magic, frame_file::FILE_MAGIC, 8 ) != 0 ||
+         header.version != frame_file::VERSION ||
+         header.headerSize < sizeof( frame_file_header ) ||
+         header.headerSize > length ){
+        std::cerr << fileName << " is not a version " << frame_file::VERSION
+                  << " frame file\n";
+        close();
+        return false;
+    }
+    if ( !findFrames( header ) ){
+        std::cerr << fileName << " has no index, " << index.size()
+                  << " frames were found by scanning it\n";
+    }
+
+    if ( readAhead > 0 ){
+        setReadAhead( readAhead );
+    }
+    return true;
+}
+
+//reads the index, or rebuilds it if the writer was not closed.
+//returns false if it had to be rebuilt.
+bool FrameFileReader::findFrames( const frame_file_header & header )
+{
+    const boost::uint64_t tableSize = boost::uint64_t( header.numFrames ) *
+                                      sizeof( frame_index_entry );
+    if ( header.indexOffset != 0 &&
+         header.indexOffset + tableSize <= length ){
+        index.resize( header.numFrames );
+        for ( size_t i = 0; i < index.size(); i ++ ){
+            const unsigned char * p = data + header.indexOffset +
+                                      i * sizeof( frame_index_entry );
+            index[i].offset = get64( p );
+            index[i].timestamp = get64( p + 8 );
+        }
+        return true;
+    }
+
+    boost::uint64_t offset = header.headerSize;
+    while ( offset + sizeof( frame_record_header ) <= length ){
+        const unsigned char * p = data + offset;
+        const boost::uint64_t storedSize = get64( p + 24 );
+        const boost::uint64_t end = offset + sizeof( frame_record_header ) +
+                                    padded( storedSize );
+        if ( get32( p ) != frame_file::FRAME_MAGIC || end > length ){
+            break;
+        }
+        frame_index_entry entry;
+        entry.offset = offset;
+        entry.timestamp = get64( p + 16 );
+        index.push_back( entry );
+        offset = end;
+    }
+    return false;
+}
+
+void FrameFileReader::close()
+{
+    stopReadAhead();
+    if ( data != NULL ){
+        munmap( const_cast< unsigned char * >( data ), length );
+        data = NULL;
+    }
+    length = 0;
+    index.clear();
+}
+
+bool FrameFileReader::read( size_t i, PointCloud & cloud ) const
+{
+    if ( i >= index.size() ||
+         index[i].offset + sizeof( frame_record_header ) > length ){
+        return false;
+    }
+    const unsigned char * record = data + index[i].offset;
+    const boost::uint32_t compression = get32( record + 4 );
+    const boost::uint32_t width = get32( record + 8 );
+    const boost::uint32_t height = get32( record + 12 );
+    const boost::uint64_t storedSize = get64( record + 24 );
+    const unsigned char * stored = record + sizeof( frame_record_header );
+
+    const size_t numPoints = size_t( width ) * height;
+    const size_t fieldSize = numPoints * frame_file::POINT_SIZE;
+    if ( get32( record ) != frame_file::FRAME_MAGIC ||
+         stored + storedSize > data + length ){
+        return false;
+    }
+
+    //the compressed frames are unpacked into a buffer of their own, the
+    //others are read straight out of the mapping.
+    std::vector< unsigned char > unpacked;
+    const unsigned char * fields = stored;
+    if ( compression == frame_file::LZF ){
+        unpacked.resize( fieldSize );
+        if ( fieldSize > 0 &&
+             pcl::lzfDecompress( stored, storedSize, &unpacked[0],
+                                 fieldSize ) != fieldSize ){
+            return false;
+        }
+        fields = unpacked.empty() ? NULL : &unpacked[0];
+    } else if ( compression != frame_file::NONE || storedSize != fieldSize ){
+        return false;
+    }
+
+    cloud.width = width;
+    cloud.height = height;
+    cloud.is_dense = false;
+    cloud.points.resize( numPoints );
+
+    const unsigned char * xs = fields;
+    const unsigned char * ys = xs + 4 * numPoints;
+    const unsigned char * zs = ys + 4 * numPoints;
+    const unsigned char * colors = zs + 4 * numPoints;
+    for ( size_t j = 0; j < numPoints; j ++ ){
+        Point & p = cloud.points[j];
+        p.x = getFloat( xs + 4 * j );
+        p.y = getFloat( ys + 4 * j );
+        p.z = getFloat( zs + 4 * j );
+        p.rgba = get32( colors + 4 * j );
+    }
+    return true;
+}
+
+FrameFileReader::PointCloud::Ptr FrameFileReader::get( size_t i )
+{
+    PointCloud::Ptr cloud;
+    bool prefetching;
+    {
+        boost::mutex::scoped_lock lock( mutex );
+        std::map< size_t, PointCloud::Ptr >::iterator it = ready.find( i );
+        if ( it != ready.end() ){
+            cloud = it->second;
+        }
+
+        //forget the frames that are no longer ahead of the reader, and
+        //let the read ahead thread go on from here.
+        nextFrame = i + 1;
+        for ( it = ready.begin(); it != ready.end(); ){
+            if ( it->first < nextFrame ||
+                 it->first >= nextFrame + readAhead ){
+                ready.erase( it ++ );
+            } else {
+                ++ it;
+            }
+        }
+        prefetching = bool( prefetchThread );
+    }
+    if ( prefetching ){
+        wanted.notify_one();
+    }
+
+    if ( !cloud ){
+        cloud.reset( new PointCloud );
+        if ( !read( i, *cloud ) ){
+            cloud.reset();
+        }
+    }
+    return cloud;
+}
+
+void FrameFileReader::setReadAhead( int frames )
+{
+    stopReadAhead();
+    readAhead = std::max( frames, 0 );
+    if ( readAhead > 0 && data != NULL ){
+        prefetchThread.reset( new boost::thread(
+                        boost::bind( &FrameFileReader::prefetchLoop, this ) ) );
+    }
+}
+
+void FrameFileReader::stopReadAhead()
+{
+    if ( prefetchThread ){
+        {
+            boost::mutex::scoped_lock lock( mutex );
+            stopping = true;
+        }
+        wanted.notify_all();
+        prefetchThread->join();
+        prefetchThread.reset();
+        stopping = false;
+    }
+    ready.clear();
+}
+
+//decodes the frames ahead of the reader one at a time, nearest first.
+void FrameFileReader::prefetchLoop()
+{
+    while ( true ){
+        size_t target = 0;
+        {
+            boost::mutex::scoped_lock lock( mutex );
+            while ( true ){
+                if ( stopping ){
+                    return;
+                }
+                const size_t end = std::min( nextFrame + readAhead,
+                                             index.size() );
+                for ( target = nextFrame; target < end &&
+                                          ready.count( target ) > 0;
+                      target ++ );
+                if ( target < end ){
+                    break;
+                }
+                wanted.wait( lock );
+            }
+        }
+
+        //have the kernel page in the frame after this one while this one
+        //is decoded.
+        adviseFrame( target + 1 );
+
+        PointCloud::Ptr cloud( new PointCloud );
+        if ( !read( target, *cloud ) ){
+            cloud.reset();
+        }
+
+        boost::mutex::scoped_lock lock( mutex );
+        if ( target >= nextFrame && target < nextFrame + readAhead ){
+            ready[ target ] = cloud;
+        }
+    }
+}
+
+void FrameFileReader::adviseFrame( size_t i ) const
+{
+    if ( i >= index.size() ){
+        return;
+    }
+    const size_t pageSize = sysconf( _SC_PAGESIZE );
+    const size_t begin = index[i].offset / pageSize * pageSize;
+    const size_t end = i + 1 < index.size() ? index[ i + 1 ].offset : length;
+    if ( end > begin ){
+        madvise( const_cast< unsigned char * >( data ) + begin, end - begin,
+                 MADV_WILLNEED );
+    }
+}
@@ -0,0 +1,177 @@
+#ifndef FRAME_FILE
+#define FRAME_FILE
+
+#include <string>
+#include <vector>
+#include <map>
+#include <stdio.h>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+//A frame file holds a whole recording of organized clouds, with a
+//timestamp for every frame and an index to find them by.
+//
+//Everything in the file is little-endian:
+//
+//  file header      frame_file_header
+//  per frame        frame_record_header, then the points, padded to a
+//                   multiple of 8 bytes
+//  index            numFrames x frame_index_entry
+//
+//A frame's points are stored field by field: all of the x values, then
+//all of the y, the z and the rgba values, which is also how pcd stores
+//compressed clouds. With compression the fields are packed with lzf.
+//
+//The writer fills in the index when it is closed. If it never was, the
+//reader finds the frames by hopping from record to record instead.
+
+namespace frame_file
+{
+    static const char FILE_MAGIC[8] = { 'D', 'O', 'O', 'R', 'F', 'R', 'M', 0 };
+    static const boost::uint32_t VERSION = 1;
+    static const boost::uint32_t FRAME_MAGIC = 0x44524346;   //"FCRD"
+
+    enum Compression {
+        NONE = 0,
+        LZF = 1
+    };
+
+    //the bytes of a point in a frame: x, y, z and rgba
+    static const size_t POINT_SIZE = 16;
+
+    //the pcd files of a recording, in frame order. If input is a
+    //directory it is every .pcd file in it, ordered by the number at the
+    //end of their names. Otherwise input is a prefix, and the files are
+    //input0.pcd, input1.pcd, ... up to the first one that is missing.
+    void listPcdFiles( const std::string & input,
+                       std::vector< std::string > & files );
+
+    //the times the pcd files of a recording were written, in microseconds,
+    //from their modification times. The times always increase: files that
+    //got the same time from a coarse file system clock are spread evenly
+    //up to the next time, or frameInterval microseconds apart at the end
+    //of the recording.
+    void pcdTimestamps( const std::vector< std::string > & files,
+                        std::vector< boost::uint64_t > & timestamps,
+                        double frameInterval=1e6/30 );
+}
+
+struct frame_file_header {
+    char magic[8];
+    boost::uint32_t version;
+    boost::uint32_t headerSize;
+    boost::uint64_t indexOffset;   //0 if the writer was not closed
+    boost::uint32_t numFrames;
+    boost::uint32_t reserved;
+};
+
+struct frame_record_header {
+    boost::uint32_t magic;
+    boost::uint32_t compression;
+    boost::uint32_t width, height;
+    boost::uint64_t timestamp;     //microseconds
+    boost::uint64_t storedSize;    //bytes of points that follow, unpadded
+};
+
+struct frame_index_entry {
+    boost::uint64_t offset;        //where the frame's record starts
+    boost::uint64_t timestamp;
+};
+
+//writes a recording to a frame file, one cloud at a time.
+class FrameFileWriter : private boost::noncopyable
+{
+public:
+    typedef pcl::PointXYZRGBA Point;
+    typedef pcl::PointCloud<Point> PointCloud;
+
+    FrameFileWriter();
+    ~FrameFileWriter();
+
+    //creates the file, replacing any file of the same name.
+    //returns false if it can not be written.
+    bool open( const std::string & fileName,
+               frame_file::Compression compression=frame_file::NONE );
+
+    //writes the index. Without it the file can still be read, only
+    //opening it takes longer.
+    void close();
+    bool isOpen() const { return file != NULL; }
+
+    //appends a frame. returns false if the write failed.
+    bool write( const PointCloud & cloud, boost::uint64_t timestamp );
+
+    size_t numFrames() const { return index.size(); }
+
+private:
+    FILE * file;
+    frame_file::Compression compression;
+    boost::uint64_t offset;                   //where the next record goes
+    std::vector< frame_index_entry > index;
+    std::vector< unsigned char > fields, packed, header;
+};
+
+//reads a frame file by mapping it into memory. Any frame can be read at
+//any time, from any thread.
+//
+//With a read ahead, a thread of the reader decodes the frames that follow
+//the last one read, so that a replay going forward finds them ready.
+class FrameFileReader : private boost::noncopyable
+{
+public:
+    typedef pcl::PointXYZRGBA Point;
+    typedef pcl::PointCloud<Point> PointCloud;
+
+    FrameFileReader();
+    ~FrameFileReader();
+
+    //maps the file and finds its frames. returns false, with a message on
+    //cerr, if it is not a frame file this reader can read.
+    bool open( const std::string & fileName );
+    void close();
+
+    size_t numFrames() const { return index.size(); }
+    boost::uint64_t timestamp( size_t i ) const { return index[i].timestamp; }
+
+    //decodes frame i into cloud. returns false if the frame is broken.
+    bool read( size_t i, PointCloud & cloud ) const;
+
+    //decodes frame i, or hands over the copy the read ahead thread
+    //already made. returns an empty pointer if the frame is broken.
+    PointCloud::Ptr get( size_t i );
+
+    //the number of frames after the last one asked for that are decoded
+    //ahead of time. 0 stops the read ahead thread.
+    void setReadAhead( int frames );
+
+private:
+    const unsigned char * data;
+    size_t length;
+    std::vector< frame_index_entry > index;
+
+    //the read ahead state is guarded by mutex.
+    int readAhead;
+    size_t nextFrame;             //the first frame to decode ahead
+    bool stopping;
+    std::map< size_t, PointCloud::Ptr > ready;
+    boost::mutex mutex;
+    boost::condition_variable wanted;
+    boost::shared_ptr< boost::thread > prefetchThread;
+
+    bool findFrames( const frame_file_header & header );
+    void stopReadAhead();
+    void prefetchLoop();
+
+    //tells the kernel that the bytes of frame i will be needed soon.
+    void adviseFrame( size_t i ) const;
+};
+
+#endif
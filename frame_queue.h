@@ -0,0 +1,107 @@
+#ifndef FRAME_QUEUE
+#define FRAME_QUEUE
+
+#include <boost/lockfree/queue.hpp>
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/thread_time.hpp>
+
+//FrameQueue passes frames between the stages of a pipeline without locks.
+//It holds at most capacity frames, and when a new frame arrives while it
+//is full the oldest frame is thrown away, so the consumer always gets the
+//freshest frames and a slow consumer never blocks the producer. The
+//only lock is the one waitPop sleeps on, which push takes just long
+//enough to wake it.
+//
+//The queue owns the frames it holds: push hands a frame over, and pop
+//hands it back to the caller, who must delete it. A queue can be given a
+//queue of spares, which then gets the frames that are dropped instead of
+//deleting them, so that their buffers can be used for another frame.
+template <class T>
+class FrameQueue
+{
+public:
+
+    FrameQueue( size_t capacity=1 ) : queue( capacity ), spares( NULL ),
+                                      numPushed( 0 ), numDropped( 0 ),
+                                      numPopped( 0 ) {}
+
+    ~FrameQueue() {
+        T * item;
+        while ( queue.pop( item ) ){
+            delete item;
+        }
+    }
+
+    //the dropped frames go to spares from now on, or are deleted if it
+    //is NULL. Set it before the queue is in use.
+    void setSpares( FrameQueue * spares ) { this->spares = spares; }
+
+    //adds a frame, dropping the oldest ones until there is room.
+    void push( T * item ) {
+        while ( !queue.bounded_push( item ) ){
+            T * oldest;
+            if ( queue.pop( oldest ) ){
+                if ( spares != NULL ){
+                    spares->push( oldest );
+                } else {
+                    delete oldest;
+                }
+                numDropped ++;
+            }
+        }
+        numPushed ++;
+
+        //the lock makes sure a consumer that just found the queue empty
+        //is already waiting
+        {
+            boost::mutex::scoped_lock lock( waitMutex );
+        }
+        frameReady.notify_one();
+    }
+
+    //returns the oldest frame in the queue, or NULL if it is empty.
+    T * pop() {
+        T * item;
+        if ( queue.pop( item ) ){
+            numPopped ++;
+            return item;
+        }
+        return NULL;
+    }
+
+    //like pop, but waits up to timeout seconds for a frame to arrive.
+    T * waitPop( double timeout ) {
+        T * item = pop();
+        if ( item != NULL ){
+            return item;
+        }
+
+        const boost::system_time end = boost::get_system_time() +
+            boost::posix_time::microseconds( long( timeout * 1e6 ) );
+        boost::mutex::scoped_lock lock( waitMutex );
+        while ( ( item = pop() ) == NULL ){
+            if ( !frameReady.timed_wait( lock, end ) ){
+                return pop();
+            }
+        }
+        return item;
+    }
+
+    //the number of frames that were pushed, dropped to make room for newer
+    //ones, and taken out.
+    unsigned long pushed() const { return numPushed; }
+    unsigned long dropped() const { return numDropped; }
+    unsigned long popped() const { return numPopped; }
+
+private:
+    boost::lockfree::queue< T *, boost::lockfree::fixed_sized< true > > queue;
+    FrameQueue * spares;
+    boost::atomic< unsigned long > numPushed, numDropped, numPopped;
+
+    boost::mutex waitMutex;
+    boost::condition_variable frameReady;
+};
+
+#endif
@@ -0,0 +1,117 @@
+#include "handle_fitter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <pcl/sample_consensus/method_types.h>
+#include <pcl/sample_consensus/model_types.h>
+
+
+HandleFitter::HandleFitter() : minDistance( 0.03 ), maxDistance( 0.1 )
+{
+    lineSeg.setOptimizeCoefficients( true );
+    lineSeg.setModelType( pcl::SACMODEL_LINE );
+    lineSeg.setMethodType( pcl::SAC_RANSAC );
+    lineSeg.setDistanceThreshold( 0.5 );
+}
+
+void HandleFitter::setPlaneOffsets( float minDistance, float maxDistance )
+{
+    this->minDistance = minDistance;
+    this->maxDistance = maxDistance;
+}
+
+void HandleFitter::setLineThreshold( float threshold )
+{
+    lineSeg.setDistanceThreshold( threshold );
+}
+
+bool HandleFitter::fit( const PointCloud & cloud, const RayTable & rays,
+                        const pcl::ModelCoefficients & plane,
+                        const cv::Rect & roi, handle_data & handle )
+{
+    if ( !handle.points ){
+        handle.points.reset( new pcl::PointCloud< pcl::PointXYZ > );
+    }
+    pcl::PointCloud< pcl::PointXYZ > & points = *handle.points;
+    points.clear();
+
+    const int x0 = std::max( roi.x, 0 );
+    const int y0 = std::max( roi.y, 0 );
+    const int x1 = std::min( roi.x + roi.width,
+                             std::min( int( cloud.width ), rays.width() ) );
+    const int y1 = std::min( roi.y + roi.height,
+                             std::min( int( cloud.height ), rays.height() ) );
+    if ( x1 <= x0 || y1 <= y0 || plane.values.size() < 4 ){
+        return false;
+    }
+    const int width = x1 - x0;
+
+    //the distance of the plane from the camera, for the normalized plane
+    const float norm = std::sqrt( plane.values[0] * plane.values[0] +
+                                  plane.values[1] * plane.values[1] +
+                                  plane.values[2] * plane.values[2] );
+    if ( norm <= 0 ){
+        return false;
+    }
+    const float d = std::fabs( plane.values[3] / norm );
+
+    rays.projectRegion( plane, cv::Rect( x0, y0, width, y1 - y0 ),
+                        planeDepths );
+
+    const float inf = std::numeric_limits< float >::infinity();
+    handle.lowerBounds = Eigen::Vector3f( inf, inf, inf );
+    handle.upperBounds = -handle.lowerBounds;
+
+    for ( int v = y0; v < y1; v ++ ){
+        const Point * row = &cloud.points[ v * cloud.width + x0 ];
+        const float * doorDepth = planeDepths.ptr< float >( v - y0 );
+
+        for ( int u = 0; u < width; u ++ ){
+            //nan points have a nan distance, which fails both tests
+            const float distance = d * std::fabs( 1 - row[u].z /
+                                                      doorDepth[u] );
+            if ( !( distance > minDistance && distance < maxDistance ) ){
+                continue;
+            }
+            pcl::PointXYZ p;
+            p.x = row[u].x;
+            p.y = row[u].y;
+            p.z = row[u].z;
+            points.push_back( p );
+
+            const Eigen::Vector3f position = p.getVector3fMap();
+            handle.lowerBounds = handle.lowerBounds.cwiseMin( position );
+            handle.upperBounds = handle.upperBounds.cwiseMax( position );
+        }
+    }
+
+    if ( points.empty() ){
+        return false;
+    }
+
+    handle.center = ( handle.upperBounds + handle.lowerBounds ) / 2;
+    handle.height = handle.upperBounds[1] - handle.lowerBounds[1];
+    handle.length = handle.upperBounds[0] - handle.lowerBounds[0];
+
+    //a line needs two points
+    handle.coeffs.values.clear();
+    if ( points.size() < 2 ){
+        return false;
+    }
+
+    lineSeg.setInputCloud( handle.points );
+    lineSeg.segment( inliers, handle.coeffs );
+    if ( handle.coeffs.values.size() < 6 ){
+        return false;
+    }
+
+    handle.pos = Eigen::Vector3f( handle.coeffs.values[0],
+                                  handle.coeffs.values[1],
+                                  handle.coeffs.values[2] );
+    handle.axis = Eigen::Vector3f( handle.coeffs.values[3],
+                                   handle.coeffs.values[4],
+                                   handle.coeffs.values[5] );
+    return true;
+}
@@ -0,0 +1,70 @@
+#ifndef HANDLE_FITTER
+#define HANDLE_FITTER
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+#include <pcl/ModelCoefficients.h>
+#include <pcl/segmentation/sac_segmentation.h>
+
+#include "opencv2/core/core.hpp"
+
+#include "ray_table.h"
+
+//the door handle found in a part of a frame
+struct handle_data {
+    //the points of the region that stand off the door plane. fit makes
+    //the cloud the first time, and reuses it after that.
+    pcl::PointCloud< pcl::PointXYZ >::Ptr points;
+
+    //the line fit to the points: a point on it, then its direction
+    pcl::ModelCoefficients coeffs;
+    Eigen::Vector3f pos, axis;
+
+    //the box around the points, its center, and how far it reaches
+    //across (x) and up (y)
+    Eigen::Vector3f lowerBounds, upperBounds, center;
+    double length, height;
+};
+
+//HandleFitter finds the door handle in a region of a frame.
+//
+//The handle is whatever stands between minDistance and maxDistance off the
+//door plane. The plane is projected over the region first, which gives the
+//depth z' the door has at every pixel. A point of the frame at depth z
+//lies on the same ray, so with the plane normalized to n.p + d = 0 it is
+//|d| |1 - z / z'| off the door, and only the depths of the frame are read.
+//The points that pass are copied into a small cloud of their own, with
+//the box around them. The line is then fit to that cloud alone, so no
+//copy of the frame is made and the cost follows the size of the region.
+//The buffers are kept from frame to frame, so the handle can be found
+//again in every frame.
+class HandleFitter
+{
+public:
+    typedef pcl::PointXYZRGBA Point;
+    typedef pcl::PointCloud<Point> PointCloud;
+
+    HandleFitter();
+
+    //the distances off the plane, in meters, that handle points are at
+    void setPlaneOffsets( float minDistance, float maxDistance );
+
+    //points within threshold meters of the handle line fit it
+    void setLineThreshold( float threshold );
+
+    //finds the handle in the pixels of roi, off the plane Ax + By + Cz + D
+    //= 0. rays are those of the camera that took the cloud, which has to
+    //be organized. roi is clipped to the cloud and the rays. returns false
+    //if no point of the region stands off the plane.
+    bool fit( const PointCloud & cloud, const RayTable & rays,
+              const pcl::ModelCoefficients & plane, const cv::Rect & roi,
+              handle_data & handle );
+
+private:
+    float minDistance, maxDistance;
+    pcl::SACSegmentation< pcl::PointXYZ > lineSeg;
+    pcl::PointIndices inliers;
+    cv::Mat planeDepths;           //of the region
+};
+
+#endif
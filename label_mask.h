@@ -0,0 +1,128 @@
+#ifndef LABEL_MASK
+#define LABEL_MASK
+
+#include <algorithm>
+#include <vector>
+
+#include <pcl/pcl_base.h>
+
+#include "opencv2/core/core.hpp"
+
+//LabelMask keeps track of which pixels of an organized cloud have been
+//claimed by a plane. It holds a label for every pixel, and a compact list
+//of the pixels that are still unclaimed, which is what the plane search
+//runs on.
+//
+//The labels are kept in a CV_8U image of the frame. reset only reuses its
+//buffer when nobody else holds it, so an image handed out for one frame is
+//never written to by the next one.
+//
+//Claiming a pixel moves the last pixel of the unclaimed list into its
+//place, so claiming a plane costs time in the size of the plane instead of
+//in the number of pixels left. The unclaimed list is therefore not sorted,
+//and the pixels to claim can come in any order.
+class LabelMask
+{
+public:
+    typedef unsigned char Label;
+    enum { UNCLAIMED = 0 };
+
+    LabelMask() : unclaimedList( new std::vector< int > ) {}
+
+    //copies get their own labels and unclaimed list, so that they can be
+    //used on another thread.
+    LabelMask( const LabelMask & other ) :
+            labels( other.labels.clone() ), position( other.position ),
+            unclaimedList( new std::vector< int >( *other.unclaimedList ) ) {}
+
+    LabelMask & operator=( const LabelMask & other ) {
+        labels = other.labels.clone();
+        position = other.position;
+        *unclaimedList = *other.unclaimedList;
+        return *this;
+    }
+
+    //makes mat a rows by cols image of type, reusing its buffer only if
+    //no other Mat shares it.
+    static void createUnshared( cv::Mat & mat, int rows, int cols, int type ) {
+        if ( mat.refcount != NULL && *mat.refcount > 1 ){
+            mat.release();
+        }
+        mat.create( rows, cols, type );
+    }
+
+    //unclaims every pixel of a rows by cols frame.
+    void reset( int rows, int cols ) {
+        const int numPixels = rows * cols;
+        createUnshared( labels, rows, cols, CV_8U );
+        labels.setTo( cv::Scalar( UNCLAIMED ) );
+        position.resize( numPixels );
+        unclaimedList->resize( numPixels );
+        for ( int i = 0; i < numPixels; i ++ ){
+            position[i] = i;
+            (*unclaimedList)[i] = i;
+        }
+    }
+
+    //unclaims only the listed pixels of a rows by cols frame.
+    void reset( int rows, int cols, const std::vector< int > & indices ) {
+        createUnshared( labels, rows, cols, CV_8U );
+        labels.setTo( cv::Scalar( UNCLAIMED ) );
+        position.assign( rows * cols, -1 );
+        *unclaimedList = indices;
+        for ( size_t i = 0; i < indices.size(); i ++ ){
+            position[ indices[i] ] = i;
+        }
+    }
+
+    //labels the pixels and takes them out of the unclaimed list. Pixels
+    //that were already claimed keep their first label.
+    void claim( const std::vector< int > & indices, Label label ) {
+        for ( size_t i = 0; i < indices.size(); i ++ ){
+            if ( position[ indices[i] ] >= 0 ){
+                labels.data[ indices[i] ] = label;
+                remove( indices[i] );
+            }
+        }
+    }
+
+    //takes the pixels out of the unclaimed list without labeling them.
+    void drop( const std::vector< int > & indices ) {
+        for ( size_t i = 0; i < indices.size(); i ++ ){
+            if ( position[ indices[i] ] >= 0 ){
+                remove( indices[i] );
+            }
+        }
+    }
+
+    bool isUnclaimed( int index ) const { return position[ index ] >= 0; }
+    Label label( int index ) const { return labels.data[ index ]; }
+
+    //the label of every pixel, UNCLAIMED for the pixels of no plane.
+    const cv::Mat & labelImage() const { return labels; }
+
+    //trades the label image for another buffer, so that the labels can be
+    //drawn into an image that someone else keeps between frames.
+    void swapLabels( cv::Mat & other ) { std::swap( labels, other ); }
+
+    //the pixels that have not been claimed yet, in no particular order.
+    const pcl::IndicesPtr & unclaimed() const { return unclaimedList; }
+    size_t numUnclaimed() const { return unclaimedList->size(); }
+
+private:
+    cv::Mat labels;
+    std::vector< int > position;   //where a pixel is in the unclaimed
+                                   //list, or -1 if it is not in it
+    pcl::IndicesPtr unclaimedList;
+
+    void remove( int index ) {
+        std::vector< int > & list = *unclaimedList;
+        const int last = list.back();
+        list[ position[ index ] ] = last;
+        position[ last ] = position[ index ];
+        position[ index ] = -1;
+        list.pop_back();
+    }
+};
+
+#endif
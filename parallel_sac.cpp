@@ -0,0 +1,526 @@
+#include "parallel_sac.h"
+
+#include <math.h>
+#include <limits>
+#include <algorithm>
+
+#include <Eigen/Core>
+#include <Eigen/Eigenvalues>
+
+#include <boost/thread/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/random/uniform_int.hpp>
+#include <boost/random/variate_generator.hpp>
+
+
+ParallelSac::ParallelSac( int method, double threshold, bool optimize )
+                      : method( method ), threshold( threshold ),
+                        optimize( optimize ), maxIterations( 50 ),
+                        probability( 0.99 ), numThreads( 0 ),
+                        seed( 12345 ), extent( 0 ),
+                        threads( 1 ), perThread( 1 ), batch( 0 ),
+                        generation( 0 ), pending( 0 ), stopping( false )
+{
+}
+
+ParallelSac::ParallelSac( const ParallelSac & other )
+                      : method( other.method ), threshold( other.threshold ),
+                        optimize( other.optimize ),
+                        maxIterations( other.maxIterations ),
+                        probability( other.probability ),
+                        numThreads( other.numThreads ),
+                        seed( other.seed ), extent( 0 ),
+                        threads( 1 ), perThread( 1 ), batch( 0 ),
+                        generation( 0 ), pending( 0 ), stopping( false )
+{
+}
+
+ParallelSac & ParallelSac::operator=( const ParallelSac & other )
+{
+    method = other.method;
+    threshold = other.threshold;
+    optimize = other.optimize;
+    maxIterations = other.maxIterations;
+    probability = other.probability;
+    numThreads = other.numThreads;
+    seed = other.seed;
+    return *this;
+}
+
+ParallelSac::~ParallelSac()
+{
+    stopWorkers();
+}
+
+void ParallelSac::setMethodType( int method )
+{
+    this->method = method;
+}
+
+void ParallelSac::setDistanceThreshold( double threshold )
+{
+    this->threshold = threshold;
+}
+
+void ParallelSac::setOptimizeCoefficients( bool optimize )
+{
+    this->optimize = optimize;
+}
+
+void ParallelSac::setMaxIterations( int maxIterations )
+{
+    this->maxIterations = maxIterations;
+}
+
+void ParallelSac::setProbability( double probability )
+{
+    this->probability = probability;
+}
+
+void ParallelSac::setNumThreads( int numThreads )
+{
+    this->numThreads = numThreads;
+}
+
+void ParallelSac::setSeed( unsigned int seed )
+{
+    this->seed = seed;
+}
+
+//copies the finite points out of the cloud, so that NaNs never reach the
+//scoring loops.
+void ParallelSac::gatherPoints( const PointCloud & cloud,
+                                const std::vector< int > & indices )
+{
+    xs.clear();
+    ys.clear();
+    zs.clear();
+    ids.clear();
+
+    Eigen::Vector3f low, high;
+    for ( size_t i = 0; i < indices.size(); i ++ ){
+        const Point & p = cloud.points[ indices[i] ];
+        if ( !pcl_isfinite( p.x ) || !pcl_isfinite( p.y ) ||
+             !pcl_isfinite( p.z ) ){
+            continue;
+        }
+        if ( ids.empty() ){
+            low = high = p.getVector3fMap();
+        } else {
+            low = low.cwiseMin( p.getVector3fMap() );
+            high = high.cwiseMax( p.getVector3fMap() );
+        }
+        xs.push_back( p.x );
+        ys.push_back( p.y );
+        zs.push_back( p.z );
+        ids.push_back( indices[i] );
+    }
+    extent = ids.empty() ? 0 : ( high - low ).norm();
+}
+
+//the growth function of PROSAC (Chum and Matas 2005). Hypothesis h draws
+//its sample from the first prosacSize[h] points.
+void ParallelSac::buildProsacSchedule( int numHypotheses )
+{
+    const int m = 3;
+    const int N = ids.size();
+    //the number of hypotheses the schedule is laid out for, as in pcl
+    const double TN = 200000;
+
+    double Tn = TN;
+    for ( int i = 0; i < m; i ++ ){
+        Tn *= double( m - i ) / ( N - i );
+    }
+
+    int n = m;
+    double TnPrime = 1;
+    prosacSize.resize( numHypotheses );
+    for ( int h = 0; h < numHypotheses; h ++ ){
+        if ( h + 1 >= TnPrime && n < N ){
+            const double Tn1 = Tn * ( n + 1 ) / ( n + 1 - m );
+            TnPrime += ceil( Tn1 - Tn );
+            Tn = Tn1;
+            n ++;
+        }
+        prosacSize[h] = n;
+    }
+}
+
+int ParallelSac::randomPoint( int thread, int range )
+{
+    boost::uniform_int<> dist( 0, range - 1 );
+    boost::variate_generator< boost::mt19937 &, boost::uniform_int<> >
+        gen( rngs[ thread ], dist );
+    return gen();
+}
+
+bool ParallelSac::drawSample( int thread, int hypothesis, float plane[4] )
+{
+    const int N = ids.size();
+    const int maxAttempts = 100;
+
+    for ( int attempt = 0; attempt < maxAttempts; attempt ++ ){
+        int a, b, c;
+        if ( method == pcl::SAC_PROSAC ){
+            //the newest point of the growing set, plus two from before it
+            const int n = hypothesis < int( prosacSize.size() ) ?
+                          prosacSize[ hypothesis ] : N;
+            a = n - 1;
+            b = randomPoint( thread, n - 1 );
+            c = randomPoint( thread, n - 1 );
+        } else {
+            a = randomPoint( thread, N );
+            b = randomPoint( thread, N );
+            c = randomPoint( thread, N );
+        }
+        if ( a == b || a == c || b == c ){
+            continue;
+        }
+
+        const Eigen::Vector3f p0( xs[a], ys[a], zs[a] );
+        const Eigen::Vector3f p1( xs[b], ys[b], zs[b] );
+        const Eigen::Vector3f p2( xs[c], ys[c], zs[c] );
+        Eigen::Vector3f normal = ( p1 - p0 ).cross( p2 - p0 );
+        const float norm = normal.norm();
+
+        //the points are nearly collinear
+        if ( norm < 1e-6 ){
+            continue;
+        }
+        normal /= norm;
+        plane[0] = normal[0];
+        plane[1] = normal[1];
+        plane[2] = normal[2];
+        plane[3] = -normal.dot( p0 );
+        return true;
+    }
+    return false;
+}
+
+double ParallelSac::score( int thread, const float plane[4], int & inliers )
+{
+    const float A = plane[0], B = plane[1], C = plane[2], D = plane[3];
+    const float t = threshold;
+    const float t2 = t * t;
+    const int N = ids.size();
+    const float * x = &xs[0];
+    const float * y = &ys[0];
+    const float * z = &zs[0];
+
+    //the randomized variants first check a single random point, and throw
+    //the hypothesis away without scoring it if that point is an outlier.
+    if ( method == pcl::SAC_RRANSAC || method == pcl::SAC_RMSAC ){
+        const int j = randomPoint( thread, N );
+        if ( fabs( A * x[j] + B * y[j] + C * z[j] + D ) >= t ){
+            inliers = 0;
+            return std::numeric_limits< double >::infinity();
+        }
+    }
+
+    int count = 0;
+    switch ( method ){
+
+    case pcl::SAC_MSAC:
+    case pcl::SAC_RMSAC: {
+        //truncated squared error
+        double cost = 0;
+        for ( int i = 0; i < N; i ++ ){
+            const float r = A * x[i] + B * y[i] + C * z[i] + D;
+            const float r2 = r * r;
+            count += r2 < t2;
+            cost += r2 < t2 ? r2 : t2;
+        }
+        inliers = count;
+        return cost;
+    }
+
+    case pcl::SAC_LMEDS: {
+        //the median of the squared error
+        std::vector< float > & r2 = scratch[ thread ];
+        r2.resize( N );
+        for ( int i = 0; i < N; i ++ ){
+            const float r = A * x[i] + B * y[i] + C * z[i] + D;
+            r2[i] = r * r;
+            count += r2[i] < t2;
+        }
+        std::nth_element( r2.begin(), r2.begin() + N / 2, r2.end() );
+        inliers = count;
+        return r2[ N / 2 ];
+    }
+
+    case pcl::SAC_MLESAC: {
+        //the negative log likelihood under a mixture of gaussian inliers
+        //and uniform outliers. The mixing weight is found with a few
+        //steps of expectation maximization.
+        std::vector< float > & r2 = scratch[ thread ];
+        r2.resize( N );
+        for ( int i = 0; i < N; i ++ ){
+            const float r = A * x[i] + B * y[i] + C * z[i] + D;
+            r2[i] = r * r;
+            count += r2[i] < t2;
+        }
+
+        const double sigma = t / 2.0;
+        const double norm = 1.0 / ( sqrt( 2 * M_PI ) * sigma );
+        const double outlierProb = 1.0 / std::max( extent, 1e-3f );
+        const double scale = -0.5 / ( sigma * sigma );
+
+        double gamma = 0.5;
+        for ( int em = 0; em < 3; em ++ ){
+            double sum = 0;
+            for ( int i = 0; i < N; i ++ ){
+                const double pin = gamma * norm * exp( scale * r2[i] );
+                sum += pin / ( pin + ( 1 - gamma ) * outlierProb );
+            }
+            gamma = sum / N;
+        }
+
+        double cost = 0;
+        for ( int i = 0; i < N; i ++ ){
+            cost -= log( gamma * norm * exp( scale * r2[i] ) +
+                         ( 1 - gamma ) * outlierProb );
+        }
+        inliers = count;
+        return cost;
+    }
+
+    default: {
+        //RANSAC, RRANSAC and PROSAC count the inliers
+        for ( int i = 0; i < N; i ++ ){
+            const float r = A * x[i] + B * y[i] + C * z[i] + D;
+            count += fabs( r ) < t;
+        }
+        inliers = count;
+        return -count;
+    }
+
+    }
+}
+
+void ParallelSac::scoreBatch( int thread )
+{
+    Hypothesis & best = threadBest[ thread ];
+    best.valid = false;
+
+    const int batchSize = threads * perThread;
+    for ( int k = 0; k < perThread; k ++ ){
+        const int h = batch * batchSize + thread + k * threads;
+        if ( h >= maxIterations ){
+            break;
+        }
+
+        float plane[4];
+        if ( !drawSample( thread, h, plane ) ){
+            continue;
+        }
+
+        int inliers;
+        const double cost = score( thread, plane, inliers );
+        if ( !best.valid || cost < best.cost ||
+             ( cost == best.cost && h < best.index ) ){
+            std::copy( plane, plane + 4, best.plane );
+            best.cost = cost;
+            best.inliers = inliers;
+            best.index = h;
+            best.valid = true;
+        }
+    }
+}
+
+void ParallelSac::startWorkers()
+{
+    if ( int( workers.size() ) == threads - 1 ){
+        return;
+    }
+    stopWorkers();
+
+    //no batch is running, so the workers all start from this generation
+    for ( int t = 1; t < threads; t ++ ){
+        workers.push_back( boost::shared_ptr< boost::thread >(
+            new boost::thread( boost::bind( &ParallelSac::workerLoop, this,
+                                            t, generation ) ) ) );
+    }
+}
+
+void ParallelSac::stopWorkers()
+{
+    {
+        boost::mutex::scoped_lock lock( batchMutex );
+        stopping = true;
+    }
+    batchReady.notify_all();
+    for ( size_t i = 0; i < workers.size(); i ++ ){
+        workers[i]->join();
+    }
+    workers.clear();
+    stopping = false;
+}
+
+void ParallelSac::workerLoop( int thread, unsigned long seen )
+{
+    while ( true ){
+        {
+            boost::mutex::scoped_lock lock( batchMutex );
+            while ( generation == seen && !stopping ){
+                batchReady.wait( lock );
+            }
+            if ( stopping ){
+                return;
+            }
+            seen = generation;
+        }
+
+        scoreBatch( thread );
+
+        boost::mutex::scoped_lock lock( batchMutex );
+        if ( -- pending == 0 ){
+            batchDone.notify_one();
+        }
+    }
+}
+
+void ParallelSac::runBatch()
+{
+    if ( !workers.empty() ){
+        {
+            boost::mutex::scoped_lock lock( batchMutex );
+            pending = workers.size();
+            generation ++;
+        }
+        batchReady.notify_all();
+    }
+
+    scoreBatch( 0 );
+
+    if ( !workers.empty() ){
+        boost::mutex::scoped_lock lock( batchMutex );
+        while ( pending > 0 ){
+            batchDone.wait( lock );
+        }
+    }
+}
+
+void ParallelSac::refine( float plane[4] ) const
+{
+    Eigen::Vector3d sum( 0, 0, 0 );
+    Eigen::Matrix3d sumSq = Eigen::Matrix3d::Zero();
+    int count = 0;
+
+    for ( size_t i = 0; i < ids.size(); i ++ ){
+        const float r = plane[0] * xs[i] + plane[1] * ys[i] +
+                        plane[2] * zs[i] + plane[3];
+        if ( fabs( r ) < threshold ){
+            const Eigen::Vector3d p( xs[i], ys[i], zs[i] );
+            sum += p;
+            sumSq += p * p.transpose();
+            count ++;
+        }
+    }
+    if ( count < 3 ){
+        return;
+    }
+
+    //the normal of the least squares plane is the direction of least
+    //variance of the inliers.
+    const Eigen::Vector3d centroid = sum / count;
+    const Eigen::Matrix3d covariance = sumSq / count -
+                                       centroid * centroid.transpose();
+    Eigen::SelfAdjointEigenSolver< Eigen::Matrix3d > solver( covariance );
+    const Eigen::Vector3d normal = solver.eigenvectors().col( 0 );
+
+    plane[0] = normal[0];
+    plane[1] = normal[1];
+    plane[2] = normal[2];
+    plane[3] = -normal.dot( centroid );
+}
+
+int ParallelSac::segment( const PointCloud & cloud,
+                          const std::vector< int > & indices,
+                          std::vector< int > & inliers,
+                          pcl::ModelCoefficients & coefficients )
+{
+    inliers.clear();
+    coefficients.values.clear();
+
+    gatherPoints( cloud, indices );
+    if ( ids.size() < 3 ){
+        return 0;
+    }
+
+    threads = numThreads > 0 ? numThreads :
+                               boost::thread::hardware_concurrency();
+    threads = std::max( 1, threads );
+    perThread = 2;
+    const int batchSize = threads * perThread;
+
+    //every call starts the streams over, so the same points always give
+    //the same plane.
+    rngs.resize( threads );
+    for ( int t = 0; t < threads; t ++ ){
+        rngs[t].seed( seed + 7919 * t );
+    }
+    threadBest.resize( threads );
+    scratch.resize( threads );
+
+    if ( method == pcl::SAC_PROSAC ){
+        buildProsacSchedule( maxIterations );
+    }
+
+    //LMEDS and MLESAC always use all of their iterations, the others stop
+    //once the chance of having missed a better plane is small enough.
+    const bool adaptive = method != pcl::SAC_LMEDS &&
+                          method != pcl::SAC_MLESAC;
+    double needed = maxIterations;
+
+    Hypothesis best;
+    best.valid = false;
+    int scored = 0;
+
+    startWorkers();
+    batch = 0;
+
+    while ( scored < maxIterations && scored < needed ){
+        runBatch();
+
+        //pick the best hypothesis of the batch. The hypothesis number
+        //breaks ties so that the thread timing never matters.
+        for ( int t = 0; t < threads; t ++ ){
+            const Hypothesis & h = threadBest[t];
+            if ( h.valid && ( !best.valid || h.cost < best.cost ||
+                              ( h.cost == best.cost && h.index < best.index ) ) ){
+                best = h;
+            }
+        }
+        scored = std::min( maxIterations, scored + batchSize );
+        batch ++;
+
+        if ( adaptive && best.valid && best.inliers > 0 ){
+            const double w = double( best.inliers ) / ids.size();
+            const double outlierSample = 1.0 - w * w * w;
+            if ( outlierSample <= 0 ){
+                needed = 0;
+            } else if ( outlierSample < 1 ){
+                needed = log( 1.0 - probability ) / log( outlierSample );
+            }
+        }
+    }
+
+    if ( !best.valid ){
+        return scored;
+    }
+
+    if ( optimize ){
+        refine( best.plane );
+    }
+
+    coefficients.values.assign( best.plane, best.plane + 4 );
+    for ( size_t i = 0; i < ids.size(); i ++ ){
+        const float r = best.plane[0] * xs[i] + best.plane[1] * ys[i] +
+                        best.plane[2] * zs[i] + best.plane[3];
+        if ( fabs( r ) < threshold ){
+            inliers.push_back( ids[i] );
+        }
+    }
+
+    return scored;
+}
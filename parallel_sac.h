@@ -0,0 +1,142 @@
+#ifndef PARALLEL_SAC
+#define PARALLEL_SAC
+
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+#include <pcl/ModelCoefficients.h>
+#include <pcl/sample_consensus/method_types.h>
+
+#include <boost/random/mersenne_twister.hpp>
+
+
+//ParallelSac finds the best plane in a set of points, like
+//pcl::SACSegmentation with SACMODEL_PLANE, but scores the plane hypotheses
+//in batches that are spread over several threads.
+//
+//Every thread draws its hypotheses from its own random number stream, and
+//the best hypothesis of a batch is picked by cost and then by hypothesis
+//number, so a fixed seed and thread count always give the same plane.
+//All of the pcl sac methods are supported: RANSAC, LMEDS, MSAC, RRANSAC,
+//RMSAC, MLESAC and PROSAC. Like pcl, PROSAC assumes that the indices are
+//ordered from the best to the worst point.
+//
+//The worker threads are started by the first call to segment and kept
+//until the object is destroyed, so that the many small searches of a
+//frame do not each start and join threads. A copy only copies the
+//settings and starts workers of its own.
+class ParallelSac
+{
+public:
+    typedef pcl::PointXYZRGBA Point;
+    typedef pcl::PointCloud<Point> PointCloud;
+
+    ParallelSac( int method=pcl::SAC_RANSAC, double threshold=0.03,
+                 bool optimize=false );
+    ParallelSac( const ParallelSac & other );
+    ParallelSac & operator=( const ParallelSac & other );
+    ~ParallelSac();
+
+    void setMethodType( int method );
+    void setDistanceThreshold( double threshold );
+    void setOptimizeCoefficients( bool optimize );
+
+    //the most hypotheses that are scored for one plane. The RANSAC style
+    //methods stop sooner once probability says the best plane was found.
+    void setMaxIterations( int maxIterations );
+    void setProbability( double probability );
+
+    //numThreads <= 0 uses one thread per core.
+    void setNumThreads( int numThreads );
+    void setSeed( unsigned int seed );
+
+    double getDistanceThreshold() const { return threshold; }
+
+    //finds the best plane among the points of the cloud listed in indices.
+    //The inliers come out in the same order as the indices, and the
+    //coefficients are in Ax + By + Cz + D = 0 form.
+    //returns the number of hypotheses that were scored.
+    int segment( const PointCloud & cloud, const std::vector< int > & indices,
+                 std::vector< int > & inliers,
+                 pcl::ModelCoefficients & coefficients );
+
+private:
+
+    struct Hypothesis {
+        float plane[4];
+        double cost;      //lower is better for every method
+        int inliers;
+        int index;        //the number of the hypothesis
+        bool valid;
+    };
+
+    int method;
+    double threshold;
+    bool optimize;
+    int maxIterations;
+    double probability;
+    int numThreads;
+    unsigned int seed;
+
+    //the finite points being searched, in structure of arrays form so
+    //that the scoring loops run over contiguous memory.
+    std::vector< float > xs, ys, zs;
+    std::vector< int > ids;
+    float extent;   //the diagonal of their bounding box
+
+    //the state of the current batch. It is written by the main thread
+    //while no batch is being scored and only read by the workers.
+    int threads, perThread, batch;
+
+    //the workers score threads 1 and up of every batch. A new generation
+    //starts a batch, and the last worker to finish it wakes the main
+    //thread.
+    std::vector< boost::shared_ptr< boost::thread > > workers;
+    boost::mutex batchMutex;
+    boost::condition_variable batchReady, batchDone;
+    unsigned long generation;
+    int pending;
+    bool stopping;
+
+    std::vector< Hypothesis > threadBest;
+    std::vector< boost::mt19937 > rngs;
+    std::vector< std::vector< float > > scratch;
+
+    //the number of top points that PROSAC samples from for each hypothesis
+    std::vector< int > prosacSize;
+
+    void gatherPoints( const PointCloud & cloud,
+                       const std::vector< int > & indices );
+    void buildProsacSchedule( int numHypotheses );
+
+    //starts or restarts the workers when the thread count changed
+    void startWorkers();
+    void stopWorkers();
+
+    void workerLoop( int thread, unsigned long seen );
+    void scoreBatch( int thread );
+
+    //scores a batch on every thread and waits for all of them
+    void runBatch();
+
+    //draws three points and fits a plane through them. returns false if
+    //no sample that was not degenerate could be found.
+    bool drawSample( int thread, int hypothesis, float plane[4] );
+
+    //returns the cost of a plane under the current method, and the number
+    //of points within the threshold.
+    double score( int thread, const float plane[4], int & inliers );
+
+    //refits the plane to its inliers with least squares.
+    void refine( float plane[4] ) const;
+
+    int randomPoint( int thread, int range );
+};
+
+#endif
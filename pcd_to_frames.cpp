@@ -0,0 +1,70 @@
+#include "frame_file.h"
+
+#include <iostream>
+#include <stdlib.h>
+
+#include <pcl/io/pcd_io.h>
+
+#include <boost/filesystem.hpp>
+
+
+void printUsage(){
+    std::cout << "Usage: ./pcd_to_frames <input> <output file> [compress]\n"
+         << "Packs a recorded sequence of pcd files into a single frame file"
+            << " that edge_detector can replay.\n"
+         << "The input is either a directory of pcd files, or a prefix such"
+            << " that the frames are <prefix>0.pcd, <prefix>1.pcd, ...\n"
+         << "The timestamp of each frame is the time its pcd file was"
+            << " written, with frames that share a time spread evenly up to"
+            << " the next one. With compress set to 1 the frames are packed"
+            << " with lzf.\n";
+}
+
+
+int main (int argc, char * argv[])
+{
+    if ( argc < 3 || argc > 4 ){
+        printUsage();
+        return 1;
+    }
+
+    const std::string input = argv[1];
+    const std::string output = argv[2];
+    const bool compress = argc >= 4 && atoi( argv[3] ) != 0;
+
+    std::vector< std::string > files;
+    frame_file::listPcdFiles( input, files );
+    if ( files.empty() ){
+        std::cerr << "no frames found for " << input << "\n";
+        return 1;
+    }
+
+    std::vector< boost::uint64_t > timestamps;
+    frame_file::pcdTimestamps( files, timestamps );
+
+    FrameFileWriter writer;
+    if ( !writer.open( output, compress ? frame_file::LZF
+                                        : frame_file::NONE ) ){
+        std::cerr << "error opening " << output << "\n";
+        return 1;
+    }
+
+    FrameFileWriter::PointCloud cloud;
+    for ( size_t i = 0; i < files.size(); i ++ ){
+        if ( pcl::io::loadPCDFile< FrameFileWriter::Point >( files[i],
+                                                             cloud ) == -1 ){
+            std::cerr << "Couldn't read file " << files[i] << "\n";
+            return 1;
+        }
+        if ( !writer.write( cloud, timestamps[i] ) ){
+            std::cerr << "error writing " << output << "\n";
+            return 1;
+        }
+    }
+    writer.close();
+
+    const boost::uintmax_t size = boost::filesystem::file_size( output );
+    std::cout << "Wrote " << writer.numFrames() << " frames to " << output
+              << " (" << size / ( 1024 * 1024 ) << " MB)\n";
+    return 0;
+}
@@ -1,6 +1,104 @@
 #include "plane_segmenter.h"
 #include <pcl/features/normal_3d.h>
 #include <pcl/sample_consensus/model_types.h>
+#include <pcl/common/time.h>
+#include <pcl/features/integral_image_normal.h>
+#include <pcl/segmentation/organized_multi_plane_segmentation.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "allocation_counter.h"
+
+
+void segmentation_stats::clear()
+{
+    for ( int i = 0; i < NUM_STAGES; i ++ ){
+        stages[i].time = 0;
+        stages[i].calls = 0;
+        stages[i].points = 0;
+    }
+    planes.clear();
+    totalTime = 0;
+}
+
+void segmentation_stats::accumulate( const segmentation_stats & other )
+{
+    for ( int i = 0; i < NUM_STAGES; i ++ ){
+        stages[i].time += other.stages[i].time;
+        stages[i].calls += other.stages[i].calls;
+        stages[i].points += other.stages[i].points;
+    }
+    planes.insert( planes.end(), other.planes.begin(), other.planes.end() );
+    totalTime += other.totalTime;
+}
+
+const char * segmentation_stats::stageName( int stage )
+{
+    static const char * names[ NUM_STAGES ] = { "sac", "rasterize", "filter",
+                                                "hough", "project",
+                                                "remove_inliers", "normals",
+                                                "region_grow", "track",
+                                                "label", "contour",
+                                                "change" };
+    if ( stage < 0 || stage >= NUM_STAGES ){
+        return "unknown";
+    }
+    return names[ stage ];
+}
+
+void segmentation_stats::print( std::ostream & ostr ) const
+{
+    ostr << "total: " << totalTime << " ms\n";
+    for ( int i = 0; i < NUM_STAGES; i ++ ){
+        ostr << "  " << stageName( i ) << ": " << stages[i].time << " ms in "
+             << stages[i].calls << " calls over " << stages[i].points
+             << " points\n";
+    }
+    for ( size_t i = 0; i < planes.size(); i ++ ){
+        const plane_stats & p = planes[i];
+        ostr << "  plane " << i << ": " << p.inliers << " of "
+             << p.candidatePoints << " points, sac " << p.sacTime
+             << " ms over " << p.iterations << " hypotheses, lines "
+             << p.lineTime << " ms ("
+             << p.depthLines << " depth, " << p.intensityLines
+             << " intensity)" << ( p.tracked ? " tracked" : "" )
+             << ( p.reused ? " reused" : "" ) << "\n";
+    }
+}
+
+
+stage_timer::stage_timer( segmentation_stats * stats,
+                          segmentation_stats::Stage stage, long points )
+                      : stats( stats ), stage( stage ), start( 0 )
+{
+    if ( stats != NULL ){
+        stats->stages[ stage ].calls ++;
+        stats->stages[ stage ].points += points;
+        start = pcl::getTime();
+    }
+}
+
+stage_timer::~stage_timer()
+{
+    stop();
+}
+
+void stage_timer::stop()
+{
+    if ( stats != NULL ){
+        stats->stages[ stage ].time += elapsed();
+        stats = NULL;
+    }
+}
+
+double stage_timer::elapsed() const
+{
+    if ( stats == NULL ){
+        return 0;
+    }
+    return ( pcl::getTime() - start ) * 1000.0;
+}
 
 
 PlaneSegmenter::PlaneSegmenter( const std::string & configFileName ){
@@ -17,11 +115,62 @@ PlaneSegmenter::PlaneSegmenter( const std::string & configFileName ){
     config.get("planeThreshold", planeThreshold);
     config.get("sacMethod" , sacMethod );
 
+    //get the region growing parameters
+    int engineType;
+    config.get("segmentationEngine", engineType );
+    engine = Engine( engineType );
+    config.get("planeAngleThreshold", planeAngleThreshold );
+    config.get("maxDepthChangeFactor", maxDepthChangeFactor );
+    config.get("normalSmoothingSize", normalSmoothingSize );
+
     seg.setOptimizeCoefficients (optimize );
     seg.setModelType (pcl::SACMODEL_PLANE);
     seg.setMethodType ( sacMethod );
     seg.setDistanceThreshold ( planeThreshold );
 
+    //get the parallel sample consensus parameters
+    int sacMaxIterations, sacThreads;
+    unsigned int sacSeed;
+    useParallelSac = config.getBool("parallelSac");
+    config.get("sacThreads", sacThreads );
+    config.get("sacSeed", sacSeed );
+    config.get("sacMaxIterations", sacMaxIterations );
+
+    seg.setMaxIterations( sacMaxIterations );
+    parallelSeg.setOptimizeCoefficients( optimize );
+    parallelSeg.setMethodType( sacMethod );
+    parallelSeg.setDistanceThreshold( planeThreshold );
+    parallelSeg.setMaxIterations( sacMaxIterations );
+    parallelSeg.setNumThreads( sacThreads );
+    parallelSeg.setSeed( sacSeed );
+
+    tracking = config.getBool("trackPlanes");
+
+    //get the line pipelining parameters
+    int numLineThreads;
+    pipelineLines = config.getBool("pipelineLines");
+    config.get("lineThreads", numLineThreads );
+    lineTasks.setNumThreads( numLineThreads );
+    keepLineImage = false;
+    drawingLines = false;
+
+    config.get("sacDecimation", decimation );
+
+    //get the change detection parameters
+    int tileSize;
+    float depthRatio, maxChangedTiles;
+    const bool changeDetection = config.getBool("changeDetection");
+    config.get("changeTileSize", tileSize );
+    config.get("changeDepthRatio", depthRatio );
+    config.get("changeMaxTiles", maxChangedTiles );
+
+    //get the boundary parameters
+    int boundaryType;
+    config.get("boundaryMethod", boundaryType );
+    boundaryMethod = BoundaryMethod( boundaryType );
+    config.get("contourEpsilon", contourEpsilon );
+    config.get("contourMinEdgeLength", contourMinEdgeLength );
+
     //get Hough parameters from config file 
     config.get("binary_rhoRes", binary_rhoRes);
     config.get("binary_thetaRes", binary_thetaRes);
@@ -51,6 +200,11 @@ PlaneSegmenter::PlaneSegmenter( const std::string & configFileName ){
     config.get( "lineDilationSize", lineDilationSize );
 
     haveSetCamera = false;
+    haveFrameEdges = false;
+    numLineJobs = 0;
+    setChangeDetection( changeDetection, tileSize, depthRatio,
+                        maxChangedTiles );
+    makeKernels();
 }
     
 
@@ -59,8 +213,17 @@ PlaneSegmenter::PlaneSegmenter( const std::string & configFileName ){
 PlaneSegmenter::PlaneSegmenter( int maxNumPlanes, int minSize,
                                 bool optimize, float threshold,
                                 int sacMethod ) : 
-        maxPlaneNumber( maxNumPlanes ), minPlaneSize( minSize) 
+        maxPlaneNumber( maxNumPlanes ), minPlaneSize( minSize),
+        engine( SAC_ENGINE ), planeAngleThreshold( 3.0 ),
+        maxDepthChangeFactor( 0.02 ), normalSmoothingSize( 20.0 ),
+        boundaryMethod( HOUGH_BOUNDARY ), contourEpsilon( 3.0 ),
+        contourMinEdgeLength( 30 ), haveFrameEdges( false ), useParallelSac( false ),
+        parallelSeg( sacMethod, threshold, optimize ), tracking( false ),
+        decimation( 1 ), pipelineLines( false ), keepLineImage( false ),
+        drawingLines( false ), numLineJobs( 0 )
 {
+    setChangeDetection( false );
+
     // Optional
     seg.setOptimizeCoefficients (optimize );
     // Mandatory
@@ -74,14 +237,90 @@ PlaneSegmenter::PlaneSegmenter( int maxNumPlanes, int minSize,
 //Sets focal length and initial points for vision algorithm
 void PlaneSegmenter::setCameraIntrinsics( float focus_x, float focus_y,
                                           float origin_x, float origin_y ){
-    fx = focus_x;
-    fy = focus_y;
-    u0 = origin_x;
-    v0 = origin_y;
+    rays.setIntrinsics( focus_x, focus_y, origin_x, origin_y );
 
     haveSetCamera = true;
 }
 
+//Sets the number of planes to search for and the smallest plane to keep
+void PlaneSegmenter::setPlaneLimits( int maxNumPlanes, int minSize ){
+    maxPlaneNumber = maxNumPlanes;
+    minPlaneSize = minSize;
+}
+
+//Chooses how the planes are found
+void PlaneSegmenter::setEngine( Engine engine ){
+    this->engine = engine;
+}
+
+//Turns on looking for the last frame's planes first
+void PlaneSegmenter::setTracking( bool track ){
+    tracking = track;
+    trackedPlanes.clear();
+}
+
+//Forgets the planes of the last frame
+void PlaneSegmenter::resetTracking(){
+    trackedPlanes.clear();
+    haveReference = false;
+}
+
+//Turns on comparing the frames to the last one that was segmented
+void PlaneSegmenter::setChangeDetection( bool detect, int tileSize,
+                                         float depthRatio,
+                                         float maxChangedTiles ){
+    detectChanges = detect;
+    changeTileSize = std::max( tileSize, CHANGE_STEP );
+    changeDepthRatio = depthRatio;
+    changeMaxTiles = maxChangedTiles;
+    haveReference = false;
+    keepStaticPlanes = false;
+    numReferencePlanes = 0;
+    tilesX = tilesY = 0;
+}
+
+//Searches for the planes on a grid of every decimation'th pixel
+void PlaneSegmenter::setDecimation( int decimation ){
+    this->decimation = std::max( 1, decimation );
+}
+
+//Finds the lines of the planes on other threads
+void PlaneSegmenter::setLinePipelining( bool pipeline, int numThreads ){
+    pipelineLines = pipeline;
+    lineTasks.setNumThreads( numThreads );
+}
+
+//Draws the picture of the lines into the result
+void PlaneSegmenter::setLineImage( bool draw ){
+    keepLineImage = draw;
+}
+
+//Chooses how the depth lines of a plane are found
+void PlaneSegmenter::setBoundaryMethod( BoundaryMethod method, float epsilon,
+                                        int minEdgeLength )
+{
+    boundaryMethod = method;
+    contourEpsilon = epsilon;
+    contourMinEdgeLength = minEdgeLength;
+}
+
+//Switches the sac engine between pcl and the parallel implementation
+void PlaneSegmenter::setParallelSac( bool parallel, int numThreads,
+                                     unsigned int seed ){
+    useParallelSac = parallel;
+    parallelSeg.setNumThreads( numThreads );
+    parallelSeg.setSeed( seed );
+}
+
+//Sets parameters for the region growing engine
+void PlaneSegmenter::setRegionGrowingParams( float angleThreshold,
+                                             float maxDepthChangeFactor,
+                                             float normalSmoothingSize ){
+    this->planeAngleThreshold = angleThreshold;
+    this->maxDepthChangeFactor = maxDepthChangeFactor;
+    this->normalSmoothingSize = normalSmoothingSize;
+}
+
 //Sets parameters for rgb HoughLines algorithm
 void PlaneSegmenter::setHoughLinesIntensity( float rho, float theta, int threshold,
                                     int minLineLength, int maxLineGap){
@@ -126,345 +365,1106 @@ void PlaneSegmenter::setFilterParams ( int blur, int filterSize,
     this->filterSize = filterSize;
     this->intensityErosionSize = intensityErosion;
     this->lineDilationSize = lineDilation;
+    makeKernels();
 }
 
+//Makes the morphology kernels of findLines once, instead of for every plane
+void PlaneSegmenter::makeKernels()
+{
+    filterKernel = cv::Mat::ones( filterSize, filterSize, CV_8U );
+    intensityKernel = cv::Mat::ones( intensityErosionSize,
+                                     intensityErosionSize, CV_8U );
+    lineKernel = cv::Mat::ones( lineDilationSize, lineDilationSize, CV_8U );
+}
+
+
+//the stats of a plane that was kept from the last frame
+static plane_stats reusedStats( const plane_data & plane )
+{
+    plane_stats planeStats;
+    planeStats.candidatePoints = 0;
+    planeStats.inliers = plane.numPixels;
+    planeStats.sacTime = 0;
+    planeStats.iterations = 0;
+    planeStats.lineTime = 0;
+    planeStats.depthLines = plane.depthLines.size() / 2;
+    planeStats.intensityLines = plane.intensityLines.size() / 2;
+    planeStats.tracked = false;
+    planeStats.reused = true;
+    return planeStats;
+}
 
 //Planar segmentation function
 void PlaneSegmenter::segment(const PointCloud::ConstPtr & cloud,
-                             std::vector< plane_data > & planes, 
-                             std::vector< LinePosArray > & linePositions,
-                             pcl::visualization::ImageViewer * viewer) 
+                             SegmentationResult & result,
+                             pcl::visualization::ImageViewer * viewer,
+                             segmentation_stats * stats ) 
 {   
     
     //if the camera parameters have not been set, the program will not work, so abort
     assert( haveSetCamera );
 
-    //initialize the model coefficients for the plane and 
-    //send the cloud to the segmenter for segmentation
-    pcl::ModelCoefficients::Ptr coefficients (new pcl::ModelCoefficients);
-    seg.setInputCloud ( cloud->makeShared() );
+    if ( stats != NULL ){
+        stats->clear();
+    }
+    const double startTime = stats != NULL ? pcl::getTime() : 0;
+    haveFrameEdges = false;
+
+    if ( rays.width() != int( cloud->width ) ||
+         rays.height() != int( cloud->height ) ){
+        rays.setSize( cloud->width, cloud->height );
+    }
 
-    //initialize the indices containers, set outliers to be all of the
-    //points inside the point cloud. 
-    pcl::PointIndices::Ptr inliers (new pcl::PointIndices);
-    pcl::IndicesPtr outliers ( new std::vector<int> );
-    outliers->resize( cloud->height * cloud->width );
+    result.clear();
 
-    for ( int i = 0; i < outliers->size(); i ++ ){
-        (*outliers)[i] = i;
+    //the planes are drawn into the picture as their lines are collected,
+    //or as they are taken over from the reference
+    drawingLines = viewer != NULL || keepLineImage;
+    if ( drawingLines ){
+        cv::Mat & image = result.getLineImage();
+        LabelMask::createUnshared( image, cloud->height, cloud->width,
+                                   CV_8UC3 );
+        image.setTo( cv::Scalar( 0, 0, 0 ) );
     }
 
-    //This do while loop is the main segmentation loop.
+    //a frame where nothing changed gets the planes of the last one
+    keepStaticPlanes = false;
+    bool unchanged = false;
+    if ( detectChanges ){
+        int numChanged;
+        {
+            stage_timer timer( stats, segmentation_stats::CHANGE,
+                               cloud->points.size() /
+                               ( CHANGE_STEP * CHANGE_STEP ) );
+            numChanged = findChangedTiles( *cloud );
+        }
+
+        unchanged = haveReference && numChanged == 0;
+        keepStaticPlanes = haveReference && !unchanged &&
+                           engine == SAC_ENGINE &&
+                           numChanged <= changeMaxTiles * changedTiles.size();
+    }
+
+    if ( unchanged ){
+        reuseReference( result, stats );
+    } else {
+        if ( engine == ORGANIZED_ENGINE ){
+            segmentOrganized( cloud, result, stats );
+        } else {
+            segmentSac( cloud, result, stats );
+        }
+
+        //collect the lines of the planes that were handed to the line
+        //threads.
+        finishLines( result, stats );
+    }
+
+    if ( viewer != NULL ){
+        const cv::Mat & image = result.getLineImage();
+        viewer->showRGBImage( image.data, image.cols, image.rows );
+    }
+
+    //a frame that reused the reference leaves it as it was
+    if ( detectChanges && !unchanged ){
+        keepReference( result );
+    }
+
+    if ( stats != NULL ){
+        stats->totalTime = ( pcl::getTime() - startTime ) * 1000.0;
+    }
+}
+
+//the coefficients of a plane in a form that can be copied without
+//allocating
+static cv::Vec4f planeVector( const pcl::ModelCoefficients & coefficients )
+{
+    if ( coefficients.values.size() != 4 ){
+        return cv::Vec4f( 0, 0, 0, 0 );
+    }
+    return cv::Vec4f( coefficients.values[0], coefficients.values[1],
+                      coefficients.values[2], coefficients.values[3] );
+}
+
+//finds the planes one at a time with sample consensus, removing the
+//inliers of each plane before searching for the next one.
+void PlaneSegmenter::segmentSac(const PointCloud::ConstPtr & cloud,
+                                SegmentationResult & result,
+                                segmentation_stats * stats ) 
+{
+    //the model coefficients and inliers of the plane live in the
+    //workspace, so that their buffers are reused from frame to frame.
+    //The segmenter only reads the cloud, so it shares the caller's cloud
+    //instead of making a copy of it.
+    pcl::ModelCoefficients & coefficients = sacCoefficients;
+    pcl::PointIndices & inliers = sacInliers;
+    seg.setInputCloud ( cloud );
+
+    //initialize the label mask, all of the points inside the point cloud
+    //start out unclaimed. The mask draws into the result's label image,
+    //and gives it back at the end.
+    mask.swapLabels( result.getLabelImage() );
+    mask.reset( cloud->height, cloud->width );
+
+    //in tracking mode, check the planes of the last frame first. Each one
+    //costs a single pass over the remaining points, which is much cheaper
+    //than a sample consensus search.
+    lastPlanes.swap( trackedPlanes );
+    trackedPlanes.clear();
+
+    //when only part of the frame changed, the planes clear of the changes
+    //are kept as they were, and are not tracked again.
+    keptPlanes.assign( lastPlanes.size(), false );
+    if ( keepStaticPlanes ){
+        keepUnchangedPlanes( result, stats );
+    }
+
+    for ( size_t i = 0; tracking && i < lastPlanes.size() &&
+                        result.size() < maxPlaneNumber; i ++ ){
+        if ( i < keptPlanes.size() && keptPlanes[i] ){
+            continue;
+        }
+        plane_stats planeStats;
+        planeStats.iterations = 0;
+        planeStats.candidatePoints = mask.numUnclaimed();
+        bool found;
+        {
+            stage_timer timer( stats, segmentation_stats::TRACK,
+                               mask.numUnclaimed() );
+            found = trackPlane( *cloud, *mask.unclaimed(), lastPlanes[i],
+                                inliers.indices, coefficients );
+            planeStats.sacTime = timer.elapsed();
+        }
+        if ( !found ){
+            continue;
+        }
+        planeStats.inliers = inliers.indices.size();
+        planeStats.tracked = true;
+        planeStats.reused = false;
+
+        const int label = std::min< int >( result.size() + 1, 255 );
+        {
+            stage_timer timer( stats, segmentation_stats::REMOVE_INLIERS,
+                               inliers.indices.size() );
+            mask.claim( inliers.indices, label );
+        }
+
+        addPlane( inliers.indices, coefficients, label, mask.labelImage(),
+                  cloud, result, stats, planeStats );
+        trackedPlanes.push_back( planeVector( coefficients ) );
+    }
+
+    //in coarse to fine mode the planes are searched for on a grid of every
+    //decimation'th pixel of every decimation'th row, and their inliers are
+    //then labeled at full resolution in a single pass.
+    LabelMask * candidates = &mask;
+    int candidateMinSize = minPlaneSize;
+    if ( decimation > 1 ){
+        const std::vector< int > & unclaimed = *mask.unclaimed();
+        gridPoints.clear();
+        gridPoints.reserve( unclaimed.size() / ( decimation * decimation ) );
+        for ( size_t i = 0; i < unclaimed.size(); i ++ ){
+            const int index = unclaimed[i];
+            if ( ( index % cloud->width ) % decimation == 0 &&
+                 ( index / cloud->width ) % decimation == 0 ){
+                gridPoints.push_back( index );
+            }
+        }
+        grid.reset( cloud->height, cloud->width, gridPoints );
+        candidates = &grid;
+        candidateMinSize = minPlaneSize / ( decimation * decimation );
+    }
+
+    //This while loop is the main segmentation loop.
     //The loop quits once the max number of planes has been reached, or
     //until the segmenter returns a plane that is smaller than the 
     //minPlaneSize.
-    do{
+    while( result.size() < maxPlaneNumber ){
 
         //this performs segmentation on only the indices that are 
-        //in outliers. 
-        seg.setIndices( outliers );
+        //still unclaimed. 
+        seg.setIndices( candidates->unclaimed() );
 
         //Perform segmentation of the plane. store the coefficients of the plane 
         //, and the inliers on the plane.
         //THe coefficients are in Ax + By + Cz + D = 0 form. 
-        seg.segment (*inliers, *coefficients);
-
+        plane_stats planeStats;
+        planeStats.iterations = 0;
+        {
+            stage_timer timer( stats, segmentation_stats::SAC,
+                               candidates->numUnclaimed() );
+            if ( useParallelSac ){
+                planeStats.iterations = parallelSeg.segment( *cloud,
+                                                 *candidates->unclaimed(),
+                                                 inliers.indices,
+                                                 coefficients );
+            } else {
+                allocation_counter::library_scope library;
+                seg.segment ( inliers, coefficients );
+            }
+            planeStats.sacTime = timer.elapsed();
+        }
+        planeStats.candidatePoints = candidates->numUnclaimed();
+        planeStats.inliers = inliers.indices.size();
+        planeStats.tracked = false;
+        planeStats.reused = false;
 
         //If the size of the found plane is too small, exit the segmenter.
-        if ( inliers->indices.size () <= minPlaneSize ) { 
-            return;
+        if ( inliers.indices.size () <= candidateMinSize ) { 
+            break;
+        }
+
+        if ( decimation > 1 ){
+            //take the plane's points off the grid, then find all of the
+            //points on the plane at full resolution.
+            grid.drop( inliers.indices );
+            {
+                stage_timer timer( stats, segmentation_stats::LABEL,
+                                   mask.numUnclaimed() );
+                selectInliers( *cloud, *mask.unclaimed(),
+                               planeVector( coefficients ),
+                               inliers.indices );
+            }
+            planeStats.inliers = inliers.indices.size();
+            if ( inliers.indices.size () <= minPlaneSize ) { 
+                continue;
+            }
+            if ( seg.getOptimizeCoefficients() ){
+                stage_timer timer( stats, segmentation_stats::LABEL,
+                                   inliers.indices.size() );
+                fitPlane( *cloud, inliers.indices, coefficients );
+            }
+        }
+
+        //claim the inliers, so that plane segmentation is repeated on all
+        //of the points that are not in planes that have already been found.
+        //planes past the 254th share the last label.
+        const int label = std::min< int >( result.size() + 1, 255 );
+        {
+            stage_timer timer( stats, segmentation_stats::REMOVE_INLIERS,
+                               inliers.indices.size() );
+            mask.claim( inliers.indices, label );
+            if ( decimation > 1 ){
+                grid.drop( inliers.indices );
+            }
+        }
+
+        addPlane( inliers.indices, coefficients, label, mask.labelImage(),
+                  cloud, result, stats, planeStats );
+        if ( tracking ){
+            trackedPlanes.push_back( planeVector( coefficients ) );
+        }
+
+    }
+
+    mask.swapLabels( result.getLabelImage() );
+
+    //let go of the caller's cloud so that the segmenter does not keep the
+    //last frame alive.
+    seg.setInputCloud ( PointCloud::ConstPtr() );
+}
+
+//samples the depths of the frame, and compares them to the reference
+int PlaneSegmenter::findChangedTiles( const PointCloud & cloud )
+{
+    const int width = cloud.width, height = cloud.height;
+    const int samplesX = ( width + CHANGE_STEP - 1 ) / CHANGE_STEP;
+    const int samplesY = ( height + CHANGE_STEP - 1 ) / CHANGE_STEP;
+
+    //missing depths are sampled as 0
+    frameDepth.resize( samplesX * samplesY );
+    for ( int sy = 0; sy < samplesY; sy ++ ){
+        const Point * row = &cloud.points[ sy * CHANGE_STEP * width ];
+        float * out = &frameDepth[ sy * samplesX ];
+        for ( int sx = 0; sx < samplesX; sx ++ ){
+            const float z = row[ sx * CHANGE_STEP ].z;
+            out[ sx ] = z > 0 ? z : 0;
+        }
+    }
+
+    tilesX = ( width + changeTileSize - 1 ) / changeTileSize;
+    tilesY = ( height + changeTileSize - 1 ) / changeTileSize;
+    changedTiles.assign( tilesX * tilesY, 1 );
+
+    if ( !haveReference || referenceWidth != width ||
+         referenceHeight != height ){
+        haveReference = false;
+        return changedTiles.size();
+    }
+
+    //count the samples of each tile, and the ones that changed
+    tileSamples.assign( 2 * changedTiles.size(), 0 );
+    for ( int sy = 0; sy < samplesY; sy ++ ){
+        const int tileRow = ( sy * CHANGE_STEP / changeTileSize ) * tilesX;
+        const float * now = &frameDepth[ sy * samplesX ];
+        const float * then = &referenceDepth[ sy * samplesX ];
+        for ( int sx = 0; sx < samplesX; sx ++ ){
+            const int tile = tileRow + sx * CHANGE_STEP / changeTileSize;
+            const bool changed = ( now[sx] == 0 ) != ( then[sx] == 0 ) ||
+                std::fabs( now[sx] - then[sx] ) > changeDepthRatio * then[sx];
+            tileSamples[ 2 * tile ] ++;
+            tileSamples[ 2 * tile + 1 ] += changed;
+        }
+    }
+
+    int numChanged = 0;
+    for ( size_t t = 0; t < changedTiles.size(); t ++ ){
+        changedTiles[t] = 16 * tileSamples[ 2 * t + 1 ] > tileSamples[ 2 * t ];
+        numChanged += changedTiles[t];
+    }
+    return numChanged;
+}
+
+//true if none of the tiles under bbox changed
+bool PlaneSegmenter::isClearOfChanges( const cv::Rect & bbox ) const
+{
+    if ( bbox.area() == 0 ){
+        return false;
+    }
+    const int tx0 = bbox.x / changeTileSize;
+    const int ty0 = bbox.y / changeTileSize;
+    const int tx1 = std::min( ( bbox.x + bbox.width - 1 ) / changeTileSize,
+                              tilesX - 1 );
+    const int ty1 = std::min( ( bbox.y + bbox.height - 1 ) / changeTileSize,
+                              tilesY - 1 );
+    for ( int ty = ty0; ty <= ty1; ty ++ ){
+        for ( int tx = tx0; tx <= tx1; tx ++ ){
+            if ( changedTiles[ ty * tilesX + tx ] ){
+                return false;
+            }
         }
+    }
+    return true;
+}
 
+//claims the planes of the reference that nothing changed around
+void PlaneSegmenter::keepUnchangedPlanes( SegmentationResult & result,
+                                          segmentation_stats * stats )
+{
+    for ( size_t i = 0; i < numReferencePlanes &&
+                        result.size() < maxPlaneNumber; i ++ ){
+        const plane_data & kept = referencePlanes[i];
+
+        //the planes past the 254th share a label, so their pixels can not
+        //be told apart
+        if ( kept.label >= 255 || !isClearOfChanges( kept.bbox ) ){
+            continue;
+        }
 
-        planes.resize( planes.size() + 1 );
-        planes.back().coeffs = *coefficients;
+        //the plane's pixels, from the reference's label image
+        {
+            stage_timer timer( stats, segmentation_stats::CHANGE,
+                               kept.bbox.area() );
+            keptPixels.clear();
+            for ( int v = kept.bbox.y; v < kept.bbox.y + kept.bbox.height;
+                  v ++ ){
+                const uint8_t * row = referenceLabels.ptr< uint8_t >( v );
+                for ( int u = kept.bbox.x;
+                      u < kept.bbox.x + kept.bbox.width; u ++ ){
+                    if ( row[u] == kept.label ){
+                        keptPixels.push_back( v * referenceLabels.cols + u );
+                    }
+                }
+            }
+        }
 
-        //Find the lines in the plane and store them in the planarLines and
-        //intensityLines vectors.
-        LineArray planarLines;
-        LineArray intensityLines;
-        findLines( inliers, cloud, planes, planarLines, intensityLines, viewer );
- 
-        //transforms the lines in the plane into lines in space.
-        linePositions.resize( linePositions.size() + 1 );
-        linesToPositions(coefficients, planarLines, linePositions.back() );
-        linePositions.resize( linePositions.size() + 1 );        
-        linesToPositions(coefficients, intensityLines, linePositions.back() );
+        const int label = std::min< int >( result.size() + 1, 255 );
+        {
+            stage_timer timer( stats, segmentation_stats::REMOVE_INLIERS,
+                               keptPixels.size() );
+            mask.claim( keptPixels, label );
+        }
 
-        //remove the indices in from outliers that are in inliers.
-        //This allows plane segmentation to be repeated on all of the points
-        //that are not in planes that have already been found.
-        filterOutIndices( *outliers, inliers->indices );
+        plane_data & plane = result.addPlane();
+        plane = kept;
+        plane.labels = mask.labelImage();
+        plane.label = label;
+        plane.reused = true;
+        if ( drawingLines ){
+            drawPlaneLines( plane, result.getLineImage() );
+        }
+        if ( stats != NULL ){
+            stats->planes.push_back( reusedStats( plane ) );
+        }
 
+        if ( i < keptPlanes.size() ){
+            keptPlanes[i] = true;
+        }
+        if ( tracking ){
+            trackedPlanes.push_back( planeVector( plane.coeffs ) );
+        }
     }
-    //if the number of planes found is greater than or equal to the
-    // max number of planes, then quit
-    while( linePositions.size() < maxPlaneNumber );
+}
 
+//hands every plane of the reference, with its lines, to a frame where
+//nothing changed
+void PlaneSegmenter::reuseReference( SegmentationResult & result,
+                                     segmentation_stats * stats )
+{
+    //the result gets a copy of the reference's labels in its own label
+    //image, so the reference never shares its buffer with a caller
+    cv::Mat & labels = result.getLabelImage();
+    LabelMask::createUnshared( labels, referenceLabels.rows,
+                               referenceLabels.cols, CV_8U );
+    referenceLabels.copyTo( labels );
+
+    for ( size_t i = 0; i < numReferencePlanes; i ++ ){
+        plane_data & plane = result.addPlane();
+        plane = referencePlanes[i];
+        plane.labels = labels;
+        plane.reused = true;
+        if ( drawingLines ){
+            drawPlaneLines( plane, result.getLineImage() );
+        }
+        if ( stats != NULL ){
+            stats->planes.push_back( reusedStats( plane ) );
+        }
+    }
+    result.setReused( true );
 }
 
+//keeps the depths and planes of the frame, to compare the next ones to
+void PlaneSegmenter::keepReference( const SegmentationResult & result )
+{
+    referenceDepth.swap( frameDepth );
+    referenceWidth = rays.width();
+    referenceHeight = rays.height();
+    haveReference = true;
+
+    //the labels are copied into a buffer of the reference's own. Sharing
+    //the frame's label image would make the engine allocate a new one for
+    //every frame.
+    if ( result.size() > 0 ){
+        const cv::Mat & labels = result[0].labels;
+        LabelMask::createUnshared( referenceLabels, labels.rows, labels.cols,
+                                   CV_8U );
+        labels.copyTo( referenceLabels );
+    }
+
+    if ( referencePlanes.size() < result.size() ){
+        referencePlanes.resize( result.size() );
+    }
+    for ( size_t i = 0; i < result.size(); i ++ ){
+        referencePlanes[i] = result[i];
+        referencePlanes[i].labels.release();
+    }
+    numReferencePlanes = result.size();
+}
 
+//looks for the plane of an earlier frame among the candidate points
+bool PlaneSegmenter::trackPlane( const PointCloud & cloud,
+                                 const std::vector< int > & candidates,
+                                 const cv::Vec4f & previous,
+                                 std::vector< int > & inliers,
+                                 pcl::ModelCoefficients & coefficients )
+{
+    selectInliers( cloud, candidates, previous, inliers );
+    if ( inliers.size() <= minPlaneSize ){
+        return false;
+    }
 
-//Removes segmented planes from the point cloud
-//This algorithm has runs in linear time in the amount of outliers.
-//This algorithm modifies the 'larger' vector in place
-//Several assumptions must hold for this algorithm to work: 
-//      1. As the index increases, the value of the ints stored must increase
-//          as well.
-//      2. The vector 'remove' must be a subset of 'larger' 
-//      3. 
-inline void PlaneSegmenter::filterOutIndices( std::vector< int > & larger,
-                       const std::vector<int> & remove){
-    int j = 0; // the index into the 'remove' vector
-    int k = 0; // the index into the 'larger' vector
-               // This index holds the next place in 'larger' that an index will
-               // be stored, facilitating the in place modification of 'larger'
+    //refit the plane to the points that still lie on it
+    return fitPlane( cloud, inliers, coefficients );
+}
 
-    for( int i = 0; i < larger.size() ; i ++ ){
+//finds the candidate points that are within the distance threshold of a plane
+void PlaneSegmenter::selectInliers( const PointCloud & cloud,
+                                    const std::vector< int > & candidates,
+                                    const cv::Vec4f & c,
+                                    std::vector< int > & inliers )
+{
+    inliers.clear();
 
-        if ( j < remove.size() && larger[i] == remove[j] ){
-            j++;
+    //normalize the plane so that the distance test is a single dot product
+    const float norm = sqrt( c[0] * c[0] + c[1] * c[1] + c[2] * c[2] );
+    if ( norm == 0 ){
+        return;
+    }
+    const float nx = c[0] / norm, ny = c[1] / norm, nz = c[2] / norm;
+    const float d = c[3] / norm;
+    const float threshold = seg.getDistanceThreshold();
+
+    //points that are not finite fail the test, since nan < x is false.
+    for ( size_t i = 0; i < candidates.size(); i ++ ){
+        const Point & p = cloud.points[ candidates[i] ];
+        if ( fabs( nx * p.x + ny * p.y + nz * p.z + d ) < threshold ){
+            inliers.push_back( candidates[i] );
         }
-        else{
-            larger[k] = larger[i];
-            k ++;
+    }
+}
+
+//least squares fit of a plane to a set of points
+bool PlaneSegmenter::fitPlane( const PointCloud & cloud,
+                               const std::vector< int > & inliers,
+                               pcl::ModelCoefficients & coefficients )
+{
+    Eigen::Vector4f plane;
+    float curvature;
+    pcl::computePointNormal( cloud, inliers, plane, curvature );
+    if ( !pcl_isfinite( plane[0] ) ){
+        return false;
+    }
+
+    coefficients.values.resize( 4 );
+    for ( int i = 0; i < 4; i ++ ){
+        coefficients.values[i] = plane[i];
+    }
+    return true;
+}
+
+//orders the planes found by region growing from largest to smallest,
+//so that they come out in the same order as the sac planes.
+struct LargerRegion {
+    const std::vector< pcl::PointIndices > & regions;
+    LargerRegion( const std::vector< pcl::PointIndices > & regions )
+                                                    : regions( regions ) {}
+    bool operator()( int a, int b ) const {
+        return regions[a].indices.size() > regions[b].indices.size();
+    }
+};
+
+//finds all of the planes in a single pass over the organized cloud.
+//The normals are computed once with integral images, and then neighbouring
+//pixels with similar normals and plane offsets are grown into regions.
+void PlaneSegmenter::segmentOrganized(const PointCloud::ConstPtr & cloud,
+                                      SegmentationResult & result,
+                                      segmentation_stats * stats ) 
+{
+    const long numPixels = cloud->height * cloud->width;
+
+    //copies of a segmenter share the normals, so they are only reused if
+    //no other copy is using them.
+    if ( !normals || !normals.unique() ){
+        normals.reset( new pcl::PointCloud< pcl::Normal > );
+    }
+    {
+        stage_timer timer( stats, segmentation_stats::NORMALS, numPixels );
+        allocation_counter::library_scope library;
+        pcl::IntegralImageNormalEstimation< Point, pcl::Normal > ne;
+        ne.setNormalEstimationMethod( ne.COVARIANCE_MATRIX );
+        ne.setMaxDepthChangeFactor( maxDepthChangeFactor );
+        ne.setNormalSmoothingSize( normalSmoothingSize );
+        ne.setInputCloud( cloud );
+        ne.compute( *normals );
+    }
+
+    double growTime;
+    {
+        stage_timer timer( stats, segmentation_stats::REGION_GROW, numPixels );
+        allocation_counter::library_scope library;
+        pcl::OrganizedMultiPlaneSegmentation< Point, pcl::Normal, pcl::Label >
+            mps;
+        mps.setMinInliers( minPlaneSize );
+        mps.setAngularThreshold( planeAngleThreshold * M_PI / 180.0 );
+        mps.setDistanceThreshold( seg.getDistanceThreshold() );
+        mps.setInputNormals( normals );
+        mps.setInputCloud( cloud );
+        mps.segment( regionCoeffs, regionInliers );
+        growTime = timer.elapsed();
+    }
+
+    std::vector< int > & order = regionOrder;
+    order.resize( regionInliers.size() );
+    for ( size_t i = 0; i < order.size(); i ++ ){
+        order[i] = i;
+    }
+    std::sort( order.begin(), order.end(), LargerRegion( regionInliers ) );
+
+    //the label image of the frame, shared by all of its planes.
+    cv::Mat & labels = result.getLabelImage();
+    LabelMask::createUnshared( labels, cloud->height, cloud->width, CV_8U );
+    labels.setTo( cv::Scalar( LabelMask::UNCLAIMED ) );
+
+    for ( size_t i = 0; i < order.size() && result.size() < maxPlaneNumber;
+          i ++ ){
+        const pcl::PointIndices & inliers = regionInliers[ order[i] ];
+        if ( inliers.indices.size() <= minPlaneSize ){
+            break;
         }
+
+        //the regions are all found together, so the growing time is split
+        //evenly between them.
+        plane_stats planeStats;
+        planeStats.iterations = 0;
+        planeStats.candidatePoints = numPixels;
+        planeStats.inliers = inliers.indices.size();
+        planeStats.sacTime = growTime / order.size();
+        planeStats.tracked = false;
+        planeStats.reused = false;
+
+        const int label = std::min< int >( result.size() + 1, 255 );
+        for ( size_t j = 0; j < inliers.indices.size(); j ++ ){
+            labels.data[ inliers.indices[j] ] = label;
+        }
+
+        addPlane( inliers.indices, regionCoeffs[ order[i] ], label, labels,
+                  cloud, result, stats, planeStats );
     }
+}
 
-    larger.resize( k );
+//finds and projects the lines of a plane, and adds the plane and its
+//lines to the outputs.
+void PlaneSegmenter::addPlane( const std::vector< int > & inliers,
+                               const pcl::ModelCoefficients & coefficients,
+                               int label, const cv::Mat & labels,
+                               const PointCloud::ConstPtr & cloud,
+                               SegmentationResult & result,
+                               segmentation_stats * stats,
+                               plane_stats & planeStats )
+{
+    plane_data & plane = result.addPlane();
+    plane.coeffs = coefficients;
+    plane.labels = labels;
+    plane.label = label;
+    plane.numPixels = inliers.size();
+
+    //find the bounding box of the plane's pixels
+    int minU = cloud->width, minV = cloud->height, maxU = -1, maxV = -1;
+    for ( size_t i = 0; i < inliers.size(); i ++ ){
+        const int u = inliers[i] % cloud->width;
+        const int v = inliers[i] / cloud->width;
+        minU = std::min( minU, u );
+        maxU = std::max( maxU, u );
+        minV = std::min( minV, v );
+        maxV = std::max( maxV, v );
+    }
+    plane.bbox = maxU < 0 ? cv::Rect() :
+                 cv::Rect( minU, minV, maxU - minU + 1, maxV - minV + 1 );
+
+    //the line jobs are kept from frame to frame, and the deque never moves
+    //them, so a job that the line threads are working on stays put.
+    if ( numLineJobs == lineJobs.size() ){
+        lineJobs.push_back( line_job() );
+    }
+    line_job * job = &lineJobs[ numLineJobs ];
+
+    //the lines of the plane go in its record of the result.
+    job->cloud = cloud;
+    job->coeffs = coefficients;
+    job->planeIndex = result.size() - 1;
+    job->planeStats = planeStats;
+    job->keepStats = stats != NULL;
+    job->stats.clear();
+
+    //the binary picture is made here, since the label image is still
+    //being written to while the lines are found.
+    rasterizePlane( plane, cloud, *job, stats );
+
+    if ( pipelineLines ){
+        numLineJobs ++;
+        const line_task task = { this, job };
+        lineTasks.run( task );
+    } else {
+        runLineJob( job );
+        finishLineJob( *job, result, stats );
+    }
 }
 
-//Transforms point cloud to a binary matrix
-inline void PlaneSegmenter::cloudToMatBinary(const std::vector< int > & validPoints,
-                       cv::Mat &mat)
+//finds and projects the lines of a plane. In pipelined mode this runs on
+//the line threads, so it only writes to the job.
+void PlaneSegmenter::runLineJob( line_job * job )
 {
-    //set the values of mat that correspond to being on the major
-    // plane of interest.
-    //These values should be 1, we will end up with a binary matrix:
-    //a value of 1 is on the plane,
-    //a value of 0 is off the plane.
-    for (int i=0; i < validPoints.size(); i++){
-        mat.at<uint8_t>( validPoints[i], 1 ) = 255;
+    const PointCloud::ConstPtr & cloud = job->cloud;
+    segmentation_stats * stats = job->keepStats ? &job->stats : NULL;
+    const double lineStart = stats != NULL ? pcl::getTime() : 0;
+
+    //Find the lines in the plane and store them in the planarLines and
+    //intensityLines vectors.
+    LineArray & planarLines = job->planarLines;
+    LineArray & intensityLines = job->intensityLines;
+    findLines( *job, cloud, stats );
+
+    //transforms the lines in the plane into lines in space.
+    {
+        stage_timer timer( stats, segmentation_stats::PROJECT,
+                           2 * ( planarLines.size() +
+                                 intensityLines.size() ) );
+        job->depthPositions.clear();
+        job->intensityPositions.clear();
+        linesToPositions( job->coeffs, planarLines, job->depthPositions );
+        linesToPositions( job->coeffs, intensityLines,
+                          job->intensityPositions );
+    }
+
+    if ( stats != NULL ){
+        job->planeStats.lineTime = ( pcl::getTime() - lineStart ) * 1000.0;
+        job->planeStats.depthLines = planarLines.size();
+        job->planeStats.intensityLines = intensityLines.size();
     }
-  
 }
 
+//moves the results of a line job into the outputs. This runs on the
+//thread that called segment, so it is also where the picture is drawn.
+void PlaneSegmenter::finishLineJob( line_job & job,
+                                    SegmentationResult & result,
+                                    segmentation_stats * stats )
+{
+    if ( drawingLines ){
+        drawJobLines( job, result.getLineImage() );
+    }
+
+    job.cloud.reset();
+
+    plane_data & plane = result[ job.planeIndex ];
+    plane.depthLines.swap( job.depthPositions );
+    plane.intensityLines.swap( job.intensityPositions );
+    plane.depthPixels.swap( job.planarLines );
+    plane.intensityPixels.swap( job.intensityLines );
+
+    if ( stats != NULL ){
+        stats->accumulate( job.stats );
+        stats->planes.push_back( job.planeStats );
+    }
+}
+
+//waits for the line threads, and adds their results in plane order
+void PlaneSegmenter::finishLines( SegmentationResult & result,
+                                  segmentation_stats * stats )
+{
+    lineTasks.wait();
+    for ( size_t i = 0; i < numLineJobs; i ++ ){
+        finishLineJob( lineJobs[i], result, stats );
+    }
+    numLineJobs = 0;
+}
+
+
+
 //Transforms point cloud to an intensity matrix
-inline void PlaneSegmenter::cloudToMatIntensity(const std::vector< int > & 
-                                                validPoints,
-                                                cv::Mat &mat,
-                                                const PointCloud::ConstPtr & cloud)
+inline void PlaneSegmenter::cloudToMatIntensity( const PointCloud & cloud,
+                                                 cv::Mat & mat )
 {
-    //set the values of mat that correspond to being on the major
-    // plane of interest.
-    //A non-zero value is on the plane and the value corresponds to the average of
-    //its rgb values, aka the intensity
-    //a value of 0 is off the plane.
-    for (int i=0; i < validPoints.size(); i++){
-        const int index = validPoints[i];
-        const Point p = cloud->points[ index ];
-        const Eigen::Vector3i rgb( p.getRGBVector3i() );
-        const uint8_t intensity = ( rgb[0] + rgb[1] + rgb[2] ) / 3; 
-        mat.at<uint8_t>( index, 1 ) = intensity;
+
+    //the intensity is the average of the rgb values. Multiplying by
+    //21846 / 2^16 gives exactly the same result as dividing by 3 for sums
+    //up to 765, and keeps the loop free of divisions and branches so that
+    //the compiler can vectorize it.
+    const Point * points = &cloud.points[0];
+    uint8_t * out = mat.data;
+    const int numPixels = cloud.height * cloud.width;
+    for ( int i = 0; i < numPixels; i ++ ){
+        const uint32_t sum = uint32_t( points[i].r ) + points[i].g +
+                             points[i].b;
+        out[i] = uint8_t( ( sum * 21846 ) >> 16 );
     }
 }
 
-//Find depth and color lines from segmented plane
-inline void PlaneSegmenter::findLines( const pcl::PointIndices::Ptr & inliers,
-                                       const PointCloud::ConstPtr & cloud,
-                                       std::vector< plane_data > & planes, 
-                                      LineArray & planarLines,
-                                      LineArray & intensityLines,
-                                      pcl::visualization::ImageViewer * viewer )
+//the intensity edges do not depend on the plane, so they are found once
+//for the whole frame, the first time a plane needs them.
+void PlaneSegmenter::findIntensityEdges( const PointCloud & cloud,
+                                         segmentation_stats * stats )
 {
-     
-    cv::Mat binary, intensity, mask, copyBinary, copyIntensity, maskedIntensity;
-   
+    const long numPixels = cloud.height * cloud.width;
+
+    //copies of a segmenter share their Mats, so the buffers are only
+    //reused if no other copy is using them.
+    LabelMask::createUnshared( frameIntensity, cloud.height, cloud.width,
+                               CV_8U );
+    LabelMask::createUnshared( frameEdges, cloud.height, cloud.width, CV_8U );
+    {
+        stage_timer timer( stats, segmentation_stats::RASTERIZE, numPixels );
+        cloudToMatIntensity( cloud, frameIntensity );
+    }
+
+    stage_timer timer( stats, segmentation_stats::FILTER, numPixels );
+    allocation_counter::library_scope library;
+    //the blur will smooth out the intensity edges.
+    cv::blur( frameIntensity, frameIntensity, cv::Size(blurSize , blurSize) );
+    cv::Canny( frameIntensity, frameEdges, cannyIntensityLowThreshold,
+                                           cannyIntensityHighThreshold,
+                                           cannyIntensitySize );
+    haveFrameEdges = true;
+}
+
+//a roi sized image in the memory of a frame sized buffer. It does not know
+//about the rest of the buffer, so the filters treat its edges as the edges
+//of the image, like they would for an image of its own.
+static cv::Mat cornerView( cv::Mat & buffer, const cv::Rect & roi )
+{
+    return cv::Mat( roi.height, roi.width, buffer.type(), buffer.data );
+}
 
-    //initialize the matrices
-    //create a binary picture from the points in inliers.
-    copyBinary    = cv::Mat::zeros(cloud->height * cloud->width, 1 , CV_8UC1 );
-    copyIntensity = cv::Mat::zeros(cloud->height * cloud->width, 1 , CV_8UC1 );
+//Makes the binary picture of a plane that findLines works on
+void PlaneSegmenter::rasterizePlane( const plane_data & plane,
+                                     const PointCloud::ConstPtr & cloud,
+                                     line_job & job,
+                                     segmentation_stats * stats )
+{
+    if ( !haveFrameEdges ){
+        findIntensityEdges( *cloud, stats );
+    }
 
-    cloudToMatBinary   (inliers->indices, copyBinary );
-    cloudToMatIntensity(inliers->indices, copyIntensity, cloud );
+    //the images only cover the bounding box of the plane, plus enough of
+    //a margin that the filters see the same pixels as on the full frame.
+    const int margin = lineMargin();
+    const cv::Rect roi = cv::Rect( plane.bbox.x - margin,
+                                   plane.bbox.y - margin,
+                                   plane.bbox.width + 2 * margin,
+                                   plane.bbox.height + 2 * margin ) &
+                         cv::Rect( 0, 0, cloud->width, cloud->height );
+    job.roi = roi;
+
+    stage_timer timer( stats, segmentation_stats::RASTERIZE, roi.area() );
+
+    //the images of a job are frame sized, and only their top left corner
+    //is used, so that they never have to be made again.
+    LabelMask::createUnshared( job.binaryBuffer, cloud->height, cloud->width,
+                               CV_8U );
+    LabelMask::createUnshared( job.maskBuffer, cloud->height, cloud->width,
+                               CV_8U );
+    LabelMask::createUnshared( job.edgeBuffer, cloud->height, cloud->width,
+                               CV_8U );
+    if ( boundaryMethod == CONTOUR_BOUNDARY ){
+        LabelMask::createUnshared( job.contourBuffer, cloud->height,
+                                   cloud->width, CV_8U );
+    }
 
-    //reshape the matrix into the shape of the image and run the
-    //canny edge detector on the resulting image.
-    copyBinary.rows = cloud->height;
-    copyBinary.cols = cloud->width;
+    //the binary picture of the plane comes straight from the label image.
+    cv::Mat binary = cornerView( job.binaryBuffer, roi );
+    cv::compare( plane.labels( roi ), double( plane.label ), binary,
+                 cv::CMP_EQ );
+}
 
-    copyIntensity.rows = cloud->height;
-    copyIntensity.cols = cloud->width;
+//Find depth and color lines from segmented plane
+inline void PlaneSegmenter::findLines( line_job & job,
+                                       const PointCloud::ConstPtr & cloud,
+                                       segmentation_stats * stats )
+{
+    const cv::Rect & roi = job.roi;
+    LineArray & planarLines = job.planarLines;
+    LineArray & intensityLines = job.intensityLines;
 
-    copyBinary.copyTo( mask );
-    copyBinary.copyTo(binary);
-    copyIntensity.copyTo( intensity );
-   
+    //views of the job's images that cover roi
+    cv::Mat binary = cornerView( job.binaryBuffer, roi );
+    cv::Mat mask = cornerView( job.maskBuffer, roi );
+    cv::Mat maskedIntensity = cornerView( job.edgeBuffer, roi );
 
+    const long numPixels = roi.area();
+   
+    stage_timer filterTimer( stats, segmentation_stats::FILTER, 2 * numPixels );
 
     bool getIntensity = true;
     ///////////////////////////////////////////////////////////////////////////
-    //Perform Canny Edge Detection
+    //Mask the intensity edges of the frame with the plane
     if ( getIntensity ){
-        //the blur will smooth out the intensity edges.
-        cv::blur( intensity, intensity, cv::Size(blurSize , blurSize) );
-        cv::Canny(intensity, intensity, cannyIntensityLowThreshold,
-                                        cannyIntensityHighThreshold,
-                                        cannyIntensitySize );
-        
         //remove the noise added by including the edges.
         //This will increase the size of the mask image so that 
         //it can get rid of the edges when copied over.
-        cv::Mat intensityKernel = cv::Mat::ones( intensityErosionSize,
-                                                 intensityErosionSize,
-                                                                 CV_8U ); 
-
-        cv::erode( mask, mask, intensityKernel);
-        intensity.copyTo( maskedIntensity, mask );
+        allocation_counter::library_scope library;
+        cv::erode( binary, mask, intensityKernel);
+        maskedIntensity.setTo( cv::Scalar( 0 ) );
+        frameEdges( roi ).copyTo( maskedIntensity, mask );
         
     }
 
-    //TODO : find out why the copy is necessary: For some reason,
-    //without the copy, the canny edge detector does not work.
-    //binary.copyTo(binary);
-
-    //this filter cleans up the noise from the sensor.        
-    //cv::blur( dst, dst, cv::Size(size , size) );
-    cv::Mat kernel = cv::Mat::ones( filterSize, filterSize, CV_8U ); 
-    cv::dilate( binary, binary, kernel);
-    cv::erode( binary, binary, kernel );
-    cv::Canny(binary, binary, cannyBinaryLowThreshold,
-                              cannyBinaryHighThreshold,
-                              cannyBinarySize);
+    const bool useHough = boundaryMethod == HOUGH_BOUNDARY;
+    if ( useHough ){
+        //TODO : find out why the copy is necessary: For some reason,
+        //without the copy, the canny edge detector does not work.
+        //binary.copyTo(binary);
+
+        //this filter cleans up the noise from the sensor.        
+        //cv::blur( dst, dst, cv::Size(size , size) );
+        allocation_counter::library_scope library;
+        cv::dilate( binary, binary, filterKernel );
+        cv::erode( binary, binary, filterKernel );
+        cv::Canny(binary, binary, cannyBinaryLowThreshold,
+                                  cannyBinaryHighThreshold,
+                                  cannyBinarySize);
+
+
+        /////////////////////////////////////////////////////////////////
+        //Perform the hough lines detection algorithm
+        cv::dilate( binary, binary, lineKernel );
+    }
+    filterTimer.stop();
 
+    if ( !useHough ){
+        stage_timer contourTimer( stats, segmentation_stats::CONTOUR,
+                                  numPixels );
+        findContourLines( job, cloud->width, cloud->height );
+    }
 
-    /////////////////////////////////////////////////////////////////////
-    //Perform the hough lines detection algorithm
-    cv::Mat kern = cv::Mat::ones( lineDilationSize, lineDilationSize, CV_8U ); 
-    cv::dilate( binary, binary, kern);
+    stage_timer houghTimer( stats, segmentation_stats::HOUGH,
+                            ( useHough ? 2 : 1 ) * numPixels );
 
     //run HoughLines on noise-filtered color and depth matrices
-    cv::HoughLinesP(binary, planarLines, binary_rhoRes, binary_thetaRes,
-              binary_threshold, binary_minLineLength, binary_maxLineGap);
-    cv::HoughLinesP(maskedIntensity, intensityLines, intensity_rhoRes,
-                    intensity_thetaRes, intensity_threshold,
-                    intensity_minLineLength, intensity_maxLineGap);
-
-
-    //if there is a viewer, then display a set of lines on the viewer.
-    if ( viewer != NULL ){     
-        cv::Mat cdst;
-
-        //TODO : make this a configurable option. Right now, this is simply
-        //a convenience mechanism.
-        bool seeBinary = true;
+    {
+        allocation_counter::library_scope library;
+        if ( useHough ){
+            cv::HoughLinesP(binary, planarLines, binary_rhoRes,
+                            binary_thetaRes, binary_threshold,
+                            binary_minLineLength, binary_maxLineGap);
+        }
+        cv::HoughLinesP(maskedIntensity, intensityLines, intensity_rhoRes,
+                        intensity_thetaRes, intensity_threshold,
+                        intensity_minLineLength, intensity_maxLineGap);
+    }
+    houghTimer.stop();
 
-        if ( seeBinary ){
-            cv::cvtColor(binary, cdst, CV_GRAY2BGR);
+    //move the lines from the bounding box back into the frame.
+    const cv::Vec4i offset( roi.x, roi.y, roi.x, roi.y );
+    for ( size_t i = 0; i < planarLines.size(); i ++ ){
+        planarLines[i] += offset;
+    }
+    for ( size_t i = 0; i < intensityLines.size(); i ++ ){
+        intensityLines[i] += offset;
+    }
+}
 
-            for( size_t i = 0; i < planarLines.size(); i++ )
-            {
-                cv::Vec4i l = planarLines[i];
-                cv::line( cdst, cv::Point(l[0], l[1]),
-                                cv::Point(l[2], l[3]),
-                                cv::Scalar(0,0,255),
-                                3, CV_AA);
-            }
+//draws the picture of a plane and its lines into the frame's picture.
+void PlaneSegmenter::drawJobLines( line_job & job, cv::Mat & image )
+{
+    const cv::Rect & roi = job.roi;
+    cv::Mat imageRoi = image( roi );
+
+    //TODO : make this a configurable option. Right now, this is simply
+    //a convenience mechanism.
+    bool seeBinary = true;
+
+    if ( seeBinary ){
+        imageRoi.setTo( cv::Scalar( 255, 255, 255 ),
+                        cornerView( job.binaryBuffer, roi ) );
+
+        for( size_t i = 0; i < job.planarLines.size(); i++ )
+        {
+            cv::Vec4i l = job.planarLines[i];
+            cv::line( image, cv::Point(l[0], l[1]),
+                             cv::Point(l[2], l[3]),
+                             cv::Scalar(0,0,255),
+                             3, CV_AA);
         }
-        else {
-            cv::cvtColor(maskedIntensity, cdst, CV_GRAY2BGR);
-
-            for( size_t i = 0; i < intensityLines.size(); i++ )
-            {
-                cv::Vec4i l = intensityLines[i];
-                cv::line( cdst, cv::Point(l[0], l[1]),
-                                cv::Point(l[2], l[3]),
-                                cv::Scalar(0,0,255),
-                                3, CV_AA);
-            }
+    }
+    else {
+        imageRoi.setTo( cv::Scalar( 255, 255, 255 ),
+                        cornerView( job.edgeBuffer, roi ) );
+
+        for( size_t i = 0; i < job.intensityLines.size(); i++ )
+        {
+            cv::Vec4i l = job.intensityLines[i];
+            cv::line( image, cv::Point(l[0], l[1]),
+                             cv::Point(l[2], l[3]),
+                             cv::Scalar(0,0,255),
+                             3, CV_AA);
         }
-        viewer->showRGBImage( cdst.data, cdst.cols, cdst.rows );
-        //planes.back().image = cv::Mat::zeros( cloud->width, cloud->height , CV_8UC1 );
-        //copyIntensity.copyTo( planes.back().image, copyBinary ); 
-        copyIntensity.copyTo( planes.back().image, copyBinary );
-        cv::cvtColor( planes.back().image, planes.back().image, CV_GRAY2BGR );
-
-      }      
-   }
-
-//this solves for the position of all of the line endpoint in the
-//these equations have been solved analytically. 
-inline void PlaneSegmenter::linesToPositions( 
-                              const pcl::ModelCoefficients::Ptr & coeffs,
-                              const LineArray & lines, 
-                              LinePosArray & linePositions               ){
+    }
+}
 
-    //extract the coefficients of the plane
-    const float A = coeffs->values[0];
-    const float B = coeffs->values[1];
-    const float C = coeffs->values[2];
-    const float D = coeffs->values[3];
-     
-    //Project each point onto the plane
-    for( int i = 0; i < lines.size(); i ++ ){
-        for ( int j = 0; j < 2; j ++ ){
+//draws a plane that was taken over from the reference the way
+//drawJobLines draws one that was segmented: its pixels in white, from its
+//labels, and its depth lines in red.
+void PlaneSegmenter::drawPlaneLines( const plane_data & plane,
+                                     cv::Mat & image ) const
+{
+    const cv::Rect & roi = plane.bbox;
+    cv::Mat imageRoi = image( roi );
+    imageRoi.setTo( cv::Scalar( 255, 255, 255 ),
+                    plane.labels( roi ) == plane.label );
+
+    for( size_t i = 0; i < plane.depthPixels.size(); i++ )
+    {
+        const cv::Vec4i & l = plane.depthPixels[i];
+        cv::line( image, cv::Point(l[0], l[1]),
+                         cv::Point(l[2], l[3]),
+                         cv::Scalar(0,0,255),
+                         3, CV_AA);
+    }
+}
 
-            const int u = lines[i][0 + j*2];
-            const int v = lines[i][1 + j*2];
+//Traces the outlines of the plane, the outer one and the ones around its
+//holes, and keeps the long edges of their polygons. This replaces the
+//closing, canny and hough chain with one pass over the picture.
+void PlaneSegmenter::findContourLines( line_job & job, int frameWidth,
+                                       int frameHeight )
+{
+    const cv::Rect & roi = job.roi;
+
+    //findContours uses up its picture, and the picture of the plane is
+    //still drawn for the viewer, so it traces a copy.
+    cv::Mat binary = cornerView( job.contourBuffer, roi );
+    cornerView( job.binaryBuffer, roi ).copyTo( binary );
+
+    job.planarLines.clear();
+    {
+        allocation_counter::library_scope library;
+        cv::findContours( binary, job.contours, job.hierarchy, CV_RETR_CCOMP,
+                          CV_CHAIN_APPROX_SIMPLE );
+    }
 
-            const float delta_u = u0 - u;
-            const float delta_v = v0 - v;
+    const int minLengthSquared = contourMinEdgeLength * contourMinEdgeLength;
+    for ( size_t c = 0; c < job.contours.size(); c ++ ){
+        {
+            allocation_counter::library_scope library;
+            cv::approxPolyDP( job.contours[c], job.polygon, contourEpsilon,
+                              true );
+        }
 
-            //These are the analytical solutions for x y and z.
-            //They were solved from the following three equations
-            //      Ax + By + Cz + D = 0
-            //      ( fx * x ) + ( z * delta_u ) = 0 
-            //      ( fy * y ) + ( z * delta_v ) = 0 
+        const size_t n = job.polygon.size();
+        if ( n < 2 ){
+            continue;
+        }
+        for ( size_t i = 0; i < n; i ++ ){
+            //a two corner polygon is one edge, not two
+            if ( n == 2 && i == 1 ){
+                break;
+            }
+            const cv::Point & a = job.polygon[i];
+            const cv::Point & b = job.polygon[ ( i + 1 ) % n ];
+            const cv::Point d = b - a;
+            if ( d.dot( d ) < minLengthSquared ){
+                continue;
+            }
 
-            const float z = D / ( A*delta_u/fx + B*delta_v/fy - C );
-            const float x = - delta_u * z / fx;
-            const float y = - delta_v * z / fy;
+            //the plane goes on past the edge of the frame, so an edge along
+            //it is not an edge of the plane.
+            const int ua = a.x + roi.x, ub = b.x + roi.x;
+            const int va = a.y + roi.y, vb = b.y + roi.y;
+            if ( ( ua == 0 && ub == 0 ) || ( va == 0 && vb == 0 ) ||
+                 ( ua == frameWidth - 1 && ub == frameWidth - 1 ) ||
+                 ( va == frameHeight - 1 && vb == frameHeight - 1 ) ){
+                continue;
+            }
 
-            linePositions.push_back( pcl::PointXYZ( x, y, z ) );
+            job.planarLines.push_back( cv::Vec4i( a.x, a.y, b.x, b.y ) );
         }
     }
 }
 
-//Transforms 2D lines returned by HoughLines into lines we can draw in viewer
-void PlaneSegmenter::matrixLinesToPositions( const pcl::ModelCoefficients::Ptr 
-                             & coeffs,
-                             const LineArray & lines, 
-                             LinePosArray & linePositions
-                            ){
-
-    //the b vector;
-    const cv::Matx31f b ( -coeffs->values[3] , 0.0, 0.0 );
-    cv::Matx33f A( 
-           coeffs->values[0], coeffs->values[1], coeffs->values[2],
-           fx               , 0.0              , 0.0,
-           0.0              , fy               , 0.0         );
+//the farthest a pixel can be from a plane and still be touched by the
+//filters of findLines
+int PlaneSegmenter::lineMargin() const
+{
+    return std::max( filterSize + cannyBinarySize + lineDilationSize,
+                     blurSize + cannyIntensitySize + intensityErosionSize ) + 1;
+}
 
-    for( int i = 0; i < lines.size(); i ++ ){
-        cv::Matx31f position [2];
-        
-        for ( int j = 0; j < 2; j ++ ){
-            int u, v;
-            u = lines[i][0 + j*2];
-            v = lines[i][1 + j*2];
-            A( 1, 2) = u0 - u;
-            A( 2, 2) = v0 - v;
-            position[j] = A.inv() * b;
+//draws the intensity of a plane's pixels
+void PlaneSegmenter::renderPlane( const plane_data & plane,
+                                  const PointCloud & cloud, cv::Mat & image )
+{
+    image.create( plane.labels.rows, plane.labels.cols, CV_8UC3 );
+    image.setTo( cv::Scalar::all( 0 ) );
+
+    for ( int v = plane.bbox.y; v < plane.bbox.y + plane.bbox.height; v ++ ){
+        const uint8_t * labelRow = plane.labels.ptr< uint8_t >( v );
+        cv::Vec3b * imageRow = image.ptr< cv::Vec3b >( v );
+        for ( int u = plane.bbox.x; u < plane.bbox.x + plane.bbox.width; u ++ ){
+            if ( labelRow[u] == plane.label ){
+                const Eigen::Vector3i rgb(
+                    cloud.points[ v * cloud.width + u ].getRGBVector3i() );
+                const uint8_t intensity = ( rgb[0] + rgb[1] + rgb[2] ) / 3;
+                imageRow[u] = cv::Vec3b( intensity, intensity, intensity );
+            }
         }
-
-        linePositions.push_back( pcl::PointXYZ( position[0](0,0), 
-                                   position[0](1,0),
-                                   position[0](2,0) ) );
-        linePositions.push_back( pcl::PointXYZ( position[1](0,0), 
-                                   position[1](1,0),
-                                   position[1](2,0) ));
-
     }
 }
 
+//this solves for the position of all of the line endpoint in the
+//frame, by intersecting their rays with the plane.
+inline void PlaneSegmenter::linesToPositions( 
+                              const pcl::ModelCoefficients & coeffs,
+                              const LineArray & lines, 
+                              LinePosArray & linePositions               ){
+    rays.projectLines( coeffs, lines, linePositions );
+}
+
 
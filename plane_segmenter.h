@@ -2,6 +2,9 @@
 #define PLANE_SEGMENTER
 
 #include <iostream>
+#include <deque>
+#include <vector>
+#include <algorithm>
 #include <exception>
 #include <assert.h>
 
@@ -17,11 +20,187 @@
 #include "opencv2/imgproc/imgproc.hpp"
 #include "opencv2/core/core.hpp"
 
+#include <boost/noncopyable.hpp>
+
 #include "SimpleConfig.h"
+#include "parallel_sac.h"
+#include "label_mask.h"
+#include "task_group.h"
+#include "ray_table.h"
 
 struct plane_data {
     pcl::ModelCoefficients coeffs;
-    cv::Mat image;
+
+    //the pixels of the plane are the ones whose value in labels is label.
+    //All of the planes of a frame share one label image, and
+    //PlaneSegmenter::renderPlane draws a picture of the plane from it.
+    cv::Mat labels;
+    int label;
+    cv::Rect bbox;     //the bounding box of the plane's pixels
+    int numPixels;
+
+    //the lines of the plane in space, every two points are the ends of
+    //one line. The depth lines come from the outline of the plane, and
+    //the intensity lines from the edges of the picture inside it.
+    std::vector< pcl::PointXYZ > depthLines, intensityLines;
+
+    //the same lines in the image, as ( u0, v0, u1, v1 ) in pixels.
+    std::vector< cv::Vec4i > depthPixels, intensityPixels;
+
+    //taken over with its lines from the last frame that was segmented,
+    //because nothing changed around it. See setChangeDetection.
+    bool reused;
+};
+
+//the planes that PlaneSegmenter::segment found in a frame, in the order
+//they were found, each with its own lines.
+//
+//A result is never copied. It is handed on with swap, which only trades
+//the buffers, so a frame's result can be given to another thread without
+//copying its lines. clear keeps the records and their buffers, so a
+//result that is reused from frame to frame stops allocating once it has
+//held the most planes it ever will.
+class SegmentationResult : private boost::noncopyable
+{
+public:
+    SegmentationResult() : numPlanes( 0 ), frameReused( false ) {}
+
+    size_t size() const { return numPlanes; }
+    bool empty() const { return numPlanes == 0; }
+
+    //true if the frame was not segmented at all, and every plane is the
+    //one of the last frame that was.
+    bool isReused() const { return frameReused; }
+    void setReused( bool reused ) { frameReused = reused; }
+
+    plane_data & operator[]( size_t i ) { return records[i]; }
+    const plane_data & operator[]( size_t i ) const { return records[i]; }
+
+    //a BGR picture of the planes and their depth lines, the size of the
+    //frame. It is only drawn when segment is given a viewer or
+    //PlaneSegmenter::setLineImage is on, otherwise it is left as it was.
+    cv::Mat & getLineImage() { return lineImage; }
+    const cv::Mat & getLineImage() const { return lineImage; }
+
+    //the image the segmenter draws the labels of the planes in. The result
+    //keeps it when it is cleared, so each result has a label buffer of its
+    //own that is reused from frame to frame, even while another result is
+    //still being looked at.
+    cv::Mat & getLabelImage() { return labelImage; }
+
+    //forgets the planes. Their label images are let go, so that the
+    //segmenter can draw the next frame's labels in the same buffer.
+    void clear() {
+        for ( size_t i = 0; i < numPlanes; i ++ ){
+            records[i].labels.release();
+        }
+        numPlanes = 0;
+        frameReused = false;
+    }
+
+    void swap( SegmentationResult & other ) {
+        records.swap( other.records );
+        std::swap( numPlanes, other.numPlanes );
+        std::swap( frameReused, other.frameReused );
+        std::swap( lineImage, other.lineImage );
+        std::swap( labelImage, other.labelImage );
+    }
+
+    //adds a plane with no lines at the end, reusing an old record if
+    //there is one. The reference is good until the next addPlane.
+    plane_data & addPlane() {
+        if ( numPlanes == records.size() ){
+            records.push_back( plane_data() );
+        }
+        plane_data & plane = records[ numPlanes ++ ];
+        plane.depthLines.clear();
+        plane.intensityLines.clear();
+        plane.depthPixels.clear();
+        plane.intensityPixels.clear();
+        plane.reused = false;
+        return plane;
+    }
+
+private:
+    std::vector< plane_data > records;   //the first numPlanes are in use
+    size_t numPlanes;
+    bool frameReused;
+    cv::Mat lineImage, labelImage;
+};
+
+//the time spent in one stage of the segmentation, summed over the planes.
+struct stage_stats {
+    double time;    //wall time in milliseconds
+    int calls;      //the number of times the stage ran
+    long points;    //the number of points or pixels the stage went through
+};
+
+//the work done for a single plane.
+struct plane_stats {
+    int candidatePoints;  //the points the plane was searched for in
+    int inliers;
+    double sacTime;       //milliseconds spent finding the plane
+    int iterations;       //hypotheses scored, 0 if the sac does not say
+    double lineTime;      //milliseconds spent finding and projecting its lines
+    int depthLines, intensityLines;
+    bool tracked;         //found again from the last frame's plane
+    bool reused;          //kept from the last frame with its lines
+};
+
+//PlaneSegmenter::segment fills this in if it is given one. Without a stats
+//object, the only cost is a pointer test per stage.
+struct segmentation_stats {
+    enum Stage {
+        SAC,            //seg.segment
+        RASTERIZE,      //the binary images of findLines, and the intensity
+                        //image of the frame
+        FILTER,         //the blur, erode, dilate and canny chain of findLines
+        HOUGH,          //cv::HoughLinesP
+        PROJECT,        //linesToPositions
+        REMOVE_INLIERS, //claiming the inliers in the label mask
+        NORMALS,        //integral image normals of the region growing engine
+        REGION_GROW,    //growing the planes of the region growing engine
+        TRACK,          //checking and refitting the last frame's planes
+        LABEL,          //full resolution inliers of the coarse to fine mode
+        CONTOUR,        //tracing and simplifying the outlines of the planes
+        CHANGE,         //comparing the depths to the last segmented frame
+        NUM_STAGES
+    };
+
+    stage_stats stages[ NUM_STAGES ];
+    std::vector< plane_stats > planes;
+    double totalTime;   //milliseconds spent in segment
+
+    segmentation_stats() { clear(); }
+
+    void clear();
+
+    //adds the stage times of another frame to these ones
+    void accumulate( const segmentation_stats & other );
+
+    static const char * stageName( int stage );
+
+    //prints one line per stage, and one per plane
+    void print( std::ostream & ostr ) const;
+};
+
+//adds the time between its construction and destruction (or the call to
+//stop) to a stage. Does nothing if stats is NULL.
+class stage_timer {
+public:
+    stage_timer( segmentation_stats * stats,
+                 segmentation_stats::Stage stage, long points );
+    ~stage_timer();
+
+    void stop();
+
+    //the milliseconds since construction, or 0 if there are no stats
+    double elapsed() const;
+
+private:
+    segmentation_stats * stats;
+    segmentation_stats::Stage stage;
+    double start;
 };
 
 class PlaneSegmenter{
@@ -32,6 +211,18 @@ public:
     typedef pcl::PointCloud<Point> PointCloud;
     typedef std::vector< cv::Vec4i > LineArray;
     typedef std::vector< pcl::PointXYZ > LinePosArray;
+
+    //the ways the planes can be found.
+    enum Engine {
+        SAC_ENGINE = 0,        //one sample consensus search per plane
+        ORGANIZED_ENGINE = 1   //region growing over the organized cloud
+    };
+
+    //the ways the depth lines are found on the picture of a plane.
+    enum BoundaryMethod {
+        HOUGH_BOUNDARY = 0,    //closing, canny and HoughLinesP
+        CONTOUR_BOUNDARY = 1   //the edges of the simplified outlines
+    };
     
     PlaneSegmenter( const std::string & configFileName );
     PlaneSegmenter(int maxNumPlanes=6, int minSize=50000,
@@ -39,12 +230,93 @@ public:
                    int sacMethod=0);
 
     //call this to actually run the segmentation algorithm.
+    //result is cleared and filled with the planes of the cloud and their
+    //lines. Reusing the same result for every frame saves reallocating it.
     //if the user wants to display an image of the lines and planes in 2d, then
-    //the user can input a pointer to an image viewer.
+    //the user can input a pointer to an image viewer. The picture is also
+    //kept in the result.
+    //if stats is not NULL, it is cleared and filled with the time spent in
+    //each stage and on each plane.
     void segment(const PointCloud::ConstPtr &cloud, 
-                 std::vector< plane_data > & planes, 
-                 std::vector< LinePosArray > & linePositions,
-                 pcl::visualization::ImageViewer * viewer=NULL  );
+                 SegmentationResult & result,
+                 pcl::visualization::ImageViewer * viewer=NULL,
+                 segmentation_stats * stats=NULL );
+
+    //set how many planes are searched for, and how many points a plane
+    //needs to have to be kept.
+    void setPlaneLimits( int maxNumPlanes, int minSize );
+
+    //choose between sample consensus and region growing.
+    void setEngine( Engine engine );
+
+    //draws the intensity of the pixels of a plane of cloud into a BGR
+    //image the size of the frame, with the rest of the frame black.
+    static void renderPlane( const plane_data & plane,
+                             const PointCloud & cloud, cv::Mat & image );
+
+    //in tracking mode the sac engine first looks for the planes it found
+    //in the last frame. Each one that still has more than minSize points
+    //within the distance threshold is refit to them with least squares,
+    //and sample consensus only searches the points that are left over.
+    //resetTracking forgets the last frame, call it when the frames that
+    //follow are not from the same scene. It also forgets the frame that
+    //change detection compares to.
+    void setTracking( bool track );
+    void resetTracking();
+
+    //with change detection, the depths of each frame are compared to the
+    //last frame that was segmented, on a grid of tileSize pixel tiles. A
+    //tile has changed if more than one in 16 of the pixels sampled in it
+    //moved by more than depthRatio of their depth, or appeared or went
+    //missing.
+    //  If no tile changed, the frame is not segmented. The result gets a
+    //  copy of the planes and lines of the last frame, and isReused.
+    //  If at most maxChangedTiles of the tiles changed, the sac engine
+    //  keeps the planes whose bounding box is clear of the changed tiles,
+    //  with their lines, and only searches the rest of the frame.
+    //  Otherwise, and with the region growing engine, the whole frame is
+    //  segmented again.
+    void setChangeDetection( bool detect, int tileSize=32,
+                             float depthRatio=0.03,
+                             float maxChangedTiles=0.5 );
+
+    //with a decimation above 1 the sac engine searches for planes on a
+    //grid of every decimation'th pixel of every decimation'th row, with a
+    //minimum plane size scaled down to match. The pixels of each plane are
+    //then labeled at full resolution, so the lines are found on the full
+    //set of inliers.
+    void setDecimation( int decimation );
+
+    //in pipelined mode the lines of each plane are found on numThreads
+    //other threads while the search for the next plane goes on. The
+    //planes and lines come out in the same order as without it.
+    void setLinePipelining( bool pipeline, int numThreads=2 );
+
+    //draws the picture of the lines that a viewer would show into the
+    //result, for a caller whose viewer lives on another thread.
+    void setLineImage( bool draw );
+
+    //score the sac hypotheses on several threads instead of with pcl.
+    //numThreads <= 0 uses every core, and a fixed seed always gives the
+    //same planes for the same cloud and thread count.
+    void setParallelSac( bool parallel, int numThreads=0,
+                         unsigned int seed=12345 );
+
+    //set the parameters of the region growing engine. Neighbouring pixels
+    //are put in the same plane if their normals are within angleThreshold
+    //degrees. The normals are smoothed over normalSmoothingSize pixels,
+    //and not across depth jumps larger than maxDepthChangeFactor.
+    void setRegionGrowingParams( float angleThreshold,
+                                 float maxDepthChangeFactor,
+                                 float normalSmoothingSize );
+
+    //choose how the depth lines of a plane are found. The contour method
+    //traces the outer and inner outlines of the plane and simplifies them
+    //into polygons whose corners are at most epsilon pixels off the
+    //outline. Polygon edges shorter than minEdgeLength pixels, and the
+    //ones along the edge of the frame, are dropped.
+    void setBoundaryMethod( BoundaryMethod method, float epsilon=3.0,
+                            int minEdgeLength=30 );
 
     //set the hough line parameters
     void setHoughLinesBinary( float rho, float theta, int threshold,
@@ -71,6 +343,13 @@ private:
     int maxPlaneNumber;
     int minPlaneSize; 
 
+    Engine engine;
+
+    //parameters of the region growing engine
+    float planeAngleThreshold;     //degrees
+    float maxDepthChangeFactor;
+    float normalSmoothingSize;
+
     //these are the parameters for the filters which are applied to images.
     int blurSize;              //this controls the size of the blurring kernel
                                //used to blur the intensity image;
@@ -88,6 +367,10 @@ private:
     int cannyIntensityLowThreshold, cannyIntensityHighThreshold;
     int cannyBinaryLowThreshold, cannyBinaryHighThreshold;
 
+    BoundaryMethod boundaryMethod;
+    float contourEpsilon;      //pixels between an outline and its polygon
+    int contourMinEdgeLength;  //pixels
+
     //these variables control the parameters of the HoughLines function.
     float binary_rhoRes, binary_thetaRes, intensity_rhoRes, intensity_thetaRes;
     int binary_threshold, binary_minLineLength, binary_maxLineGap ;
@@ -95,55 +378,231 @@ private:
 
     //these are the intrinsics of the camera, they must be set for the
     //function to work. Not setting these values results in an assertion failure.
-    float fx, fy, u0, v0;
+    //The table is sized to the frames by segment.
+    RayTable rays;
 
     bool haveSetCamera;
+
+    //the intensity image and intensity edges of the frame being segmented.
+    //findLines masks the edges with each plane.
+    cv::Mat frameIntensity, frameEdges;
+    bool haveFrameEdges;
  
     pcl::SACSegmentation<Point> seg;
 
-    //this modifies the vector "larger" in place, and resizes it.
-    //This function assumes that both structures hold integer
-    //values that get larger. 
-    inline void filterOutIndices( std::vector< int > & larger,
-                           const std::vector<int> & remove     );
+    bool useParallelSac;
+    ParallelSac parallelSeg;
+
+    //the planes found in the last frame, used in tracking mode
+    bool tracking;
+    std::vector< cv::Vec4f > trackedPlanes, lastPlanes;
+
+    int decimation;   //1 searches every pixel
+
+    //change detection compares a frame to the reference, the depths of
+    //every CHANGE_STEP'th pixel of every CHANGE_STEP'th row of the last
+    //frame that was segmented. Its planes are kept to be reused, with
+    //their label image copied into referenceLabels, so that the records
+    //of the reference never share the label image of the frame.
+    static const int CHANGE_STEP = 4;
+    bool detectChanges;
+    int changeTileSize;
+    float changeDepthRatio, changeMaxTiles;
+    bool haveReference, keepStaticPlanes;
+    int referenceWidth, referenceHeight;
+    std::vector< float > referenceDepth, frameDepth;
+    std::vector< plane_data > referencePlanes;   //with no labels of their own
+    cv::Mat referenceLabels;
+    size_t numReferencePlanes;
+    int tilesX, tilesY;
+    std::vector< unsigned char > changedTiles;
+    std::vector< int > tileSamples;   //samples and changed samples per tile
+    std::vector< bool > keptPlanes;    //of the reference, by index
+    std::vector< int > keptPixels;
+
+    //the lines of a plane that are still being found. The job holds
+    //everything that the line threads read and write.
+    //The jobs are reused from frame to frame.
+    struct line_job {
+        PointCloud::ConstPtr cloud;  //held until the job is finished
+        pcl::ModelCoefficients coeffs;
+        cv::Rect roi;                //the part of the frame being looked at
+
+        //frame sized images, of which the top left roi sized corner is
+        //used: the pixels of the plane, the eroded plane, and the
+        //intensity edges under it.
+        cv::Mat binaryBuffer, maskBuffer, edgeBuffer;
+
+        //the copy of the pixels of the plane that the contour boundary
+        //method traces
+        cv::Mat contourBuffer;
+
+        LineArray planarLines, intensityLines;
+
+        //the outlines of the plane and their polygons, for the contour
+        //boundary method
+        std::vector< std::vector< cv::Point > > contours;
+        std::vector< cv::Vec4i > hierarchy;
+        std::vector< cv::Point > polygon;
+
+        size_t planeIndex;           //the plane of the result it is for
+        LinePosArray depthPositions, intensityPositions;
+        plane_stats planeStats;
+        bool keepStats;
+        segmentation_stats stats;
+    };
+
+    bool pipelineLines;
+    bool keepLineImage, drawingLines;
+    TaskGroup lineTasks;
+    std::deque< line_job > lineJobs;   //the first numLineJobs are handed
+    size_t numLineJobs;                //to lineTasks, in plane order
+
+    //the pixels claimed by the planes of the sac engine, and the grid
+    //that the coarse to fine mode searches on. They are kept between
+    //frames so that their buffers are reused.
+    LabelMask mask, grid;
+    std::vector< int > gridPoints;
+
+    //the normals and regions of the region growing engine, kept between
+    //frames like the mask
+    pcl::PointCloud< pcl::Normal >::Ptr normals;
+    std::vector< pcl::ModelCoefficients > regionCoeffs;
+    std::vector< pcl::PointIndices > regionInliers;
+    std::vector< int > regionOrder;
 
-    //this takes a set of indices (validPoints) and sets the corresponding
-    //cells in a matrix to 255. The matrix should start out as a matrix of all
-    //zeros.
-    //This creates a binary image that can be easily used to threshold and
-    //find lines or features.
-    inline void cloudToMatBinary(const std::vector< int > & validPoints,
-                           cv::Mat &mat                            );
+    //the plane that the sac engine is working on
+    pcl::ModelCoefficients sacCoefficients;
+    pcl::PointIndices sacInliers;
 
-    inline void cloudToMatIntensity(
-                                        const std::vector< int > & validPoints,
-                                        cv::Mat &mat,
-                                        const PointCloud::ConstPtr & cloud);
+    //the morphology kernels of findLines
+    cv::Mat filterKernel, intensityKernel, lineKernel;
+    void makeKernels();
 
+    //the two engines behind segment.
+    void segmentSac(const PointCloud::ConstPtr &cloud, 
+                    SegmentationResult & result,
+                    segmentation_stats * stats );
+
+    void segmentOrganized(const PointCloud::ConstPtr &cloud, 
+                          SegmentationResult & result,
+                          segmentation_stats * stats );
+
+    //samples the depths of the frame and marks the tiles that changed
+    //since the reference. returns the number of changed tiles, which is
+    //all of them if there is no reference of the same size.
+    int findChangedTiles( const PointCloud & cloud );
+    bool isClearOfChanges( const cv::Rect & bbox ) const;
+
+    //claims the planes of the reference that are clear of the changed
+    //tiles, and adds them to the result with their lines.
+    void keepUnchangedPlanes( SegmentationResult & result,
+                              segmentation_stats * stats );
+
+    //gives a frame where nothing changed the planes of the reference
+    void reuseReference( SegmentationResult & result,
+                         segmentation_stats * stats );
+
+    //makes the frame just segmented the reference
+    void keepReference( const SegmentationResult & result );
+
+    //looks for the plane previous among the candidate points of the cloud.
+    //If more than minPlaneSize of them are within the distance threshold,
+    //they are returned as the inliers, the plane is refit to them and
+    //true is returned.
+    bool trackPlane( const PointCloud & cloud,
+                     const std::vector< int > & candidates,
+                     const cv::Vec4f & previous,
+                     std::vector< int > & inliers,
+                     pcl::ModelCoefficients & coefficients );
+
+    void runLineJob( line_job * job );
+
+    //the task that runs a line job on lineTasks. It is two pointers, so
+    //boost::function holds it without allocating.
+    struct line_task {
+        PlaneSegmenter * segmenter;
+        line_job * job;
+        void operator()() const { segmenter->runLineJob( job ); }
+    };
+    void finishLineJob( line_job & job,
+                        SegmentationResult & result,
+                        segmentation_stats * stats );
+
+    //draws the picture of the job's plane and its lines into image
+    void drawJobLines( line_job & job, cv::Mat & image );
+
+    //draws a plane of the reference and the lines it kept into image
+    void drawPlaneLines( const plane_data & plane, cv::Mat & image ) const;
+
+    //waits for the line threads and puts their lines in the result.
+    void finishLines( SegmentationResult & result,
+                      segmentation_stats * stats );
+
+    //puts the candidate points that are within the distance threshold of
+    //plane in inliers, in the same order as the candidates.
+    void selectInliers( const PointCloud & cloud,
+                        const std::vector< int > & candidates,
+                        const cv::Vec4f & plane,
+                        std::vector< int > & inliers );
+
+    //fits a plane to the inliers with least squares. returns false if the
+    //points do not define a plane.
+    bool fitPlane( const PointCloud & cloud,
+                   const std::vector< int > & inliers,
+                   pcl::ModelCoefficients & coefficients );
+
+    //adds a newly found plane to the outputs and finds its lines, or hands
+    //them to the line threads in pipelined mode.
+    void addPlane( const std::vector< int > & inliers,
+                   const pcl::ModelCoefficients & coefficients,
+                   int label, const cv::Mat & labels,
+                   const PointCloud::ConstPtr & cloud,
+                   SegmentationResult & result,
+                   segmentation_stats * stats,
+                   plane_stats & planeStats );
+
+    //this sets every cell of mat to the intensity of its point.
+    inline void cloudToMatIntensity( const PointCloud & cloud, cv::Mat & mat );
+
+    //blurs the intensity image of the frame and finds its canny edges.
+    void findIntensityEdges( const PointCloud & cloud,
+                             segmentation_stats * stats );
+
+
+    //how far around the bounding box of a plane findLines has to look.
+    int lineMargin() const;
+
+    //makes the binary picture of the plane that findLines works on. It
+    //covers the job's roi, the bounding box of the plane plus lineMargin.
+    void rasterizePlane( const plane_data & plane,
+                         const PointCloud::ConstPtr & cloud,
+                         line_job & job,
+                         segmentation_stats * stats );
 
     //This takes an image (preferably a binary image) and performs the canny
-    //edge detection algorithm. Then a houghLine algorithm is run to extract lines
-    inline void findLines(const pcl::PointIndices::Ptr & inliers,
+    //edge detection algorithm. Then a houghLine algorithm is run to extract lines.
+    //The images only cover the bounding box of the plane, and the lines
+    //come out in frame coordinates.
+    inline void findLines(line_job & job,
                           const PointCloud::ConstPtr & cloud,
-                          std::vector< plane_data > & planes, 
-                          LineArray & planarLines,
-                          LineArray & intensityLines,
-                          pcl::visualization::ImageViewer * viewer );
+                          segmentation_stats * stats );
+
+    //the depth lines of the contour boundary method: the edges of the
+    //simplified outer and inner outlines of the job's binary picture, in
+    //roi coordinates. The picture is left as it was.
+    void findContourLines( line_job & job, int frameWidth, int frameHeight );
     
 
     //this takes the equation of a plane (Ax + By + Cz + D = 0) as coeffs,
     //and the positions of the endpoints of lines in a picture.
     //These endpoints are then projected onto the plane to convert the 2d 
     //line positions into 3d lines on the plane.
-    //the projection equations have been solved analytically. 
-    inline void linesToPositions( const pcl::ModelCoefficients::Ptr & coeffs,
+    //the rays of the pixels come from the ray table.
+    inline void linesToPositions( const pcl::ModelCoefficients & coeffs,
                                   const LineArray & lines, 
                                   LinePosArray & linePositions               );
 
-    inline void matrixLinesToPositions( const pcl::ModelCoefficients::Ptr & coeffs,
-                                       const LineArray & lines, 
-                                       LinePosArray & linePositions               );
-
     inline void orderPoints();
 
 };
@@ -0,0 +1,103 @@
+#include "ray_table.h"
+
+#include <algorithm>
+#include <cassert>
+
+
+RayTable::RayTable() : fx( 1 ), fy( 1 ), u0( 0 ), v0( 0 )
+{
+}
+
+void RayTable::setIntrinsics( float fx, float fy, float u0, float v0 )
+{
+    this->fx = fx;
+    this->fy = fy;
+    this->u0 = u0;
+    this->v0 = v0;
+    makeTables();
+}
+
+void RayTable::setSize( int width, int height )
+{
+    rayX.resize( std::max( width, 0 ) );
+    rayY.resize( std::max( height, 0 ) );
+    makeTables();
+}
+
+void RayTable::makeTables()
+{
+    for ( size_t u = 0; u < rayX.size(); u ++ ){
+        rayX[u] = ( float( u ) - u0 ) / fx;
+    }
+    for ( size_t v = 0; v < rayY.size(); v ++ ){
+        rayY[v] = ( float( v ) - v0 ) / fy;
+    }
+}
+
+pcl::PointXYZ RayTable::project( const pcl::ModelCoefficients & plane,
+                                 int u, int v ) const
+{
+    const float rx = rayAtColumn( u );
+    const float ry = rayAtRow( v );
+    const float z = - plane.values[3] / ( plane.values[0] * rx +
+                                          plane.values[1] * ry +
+                                          plane.values[2] );
+    return pcl::PointXYZ( rx * z, ry * z, z );
+}
+
+void RayTable::projectLines( const pcl::ModelCoefficients & plane,
+                             const LineArray & lines,
+                             LinePosArray & positions ) const
+{
+    const float A = plane.values[0];
+    const float B = plane.values[1];
+    const float C = plane.values[2];
+    const float D = plane.values[3];
+
+    const size_t first = positions.size();
+    positions.resize( first + 2 * lines.size() );
+
+    for ( size_t i = 0; i < lines.size(); i ++ ){
+        const cv::Vec4i & l = lines[i];
+        const float rx0 = rayAtColumn( l[0] ), ry0 = rayAtRow( l[1] );
+        const float rx1 = rayAtColumn( l[2] ), ry1 = rayAtRow( l[3] );
+
+        //both ends are worked out together, so that the two divisions do
+        //not wait on each other.
+        const float z0 = - D / ( A * rx0 + B * ry0 + C );
+        const float z1 = - D / ( A * rx1 + B * ry1 + C );
+
+        pcl::PointXYZ & p0 = positions[ first + 2 * i ];
+        pcl::PointXYZ & p1 = positions[ first + 2 * i + 1 ];
+        p0.x = rx0 * z0;  p0.y = ry0 * z0;  p0.z = z0;
+        p1.x = rx1 * z1;  p1.y = ry1 * z1;  p1.z = z1;
+    }
+}
+
+void RayTable::projectRegion( const pcl::ModelCoefficients & plane,
+                              const cv::Rect & roi, cv::Mat & depths ) const
+{
+    assert( roi.x >= 0 && roi.y >= 0 && roi.x + roi.width <= width() &&
+            roi.y + roi.height <= height() );
+
+    const float A = plane.values[0];
+    const float B = plane.values[1];
+    const float C = plane.values[2];
+    const float D = plane.values[3];
+
+    depths.create( roi.height, roi.width, CV_32F );
+    if ( roi.area() == 0 ){
+        return;
+    }
+
+    //the row adds the same term to every column, so the inner loop is a
+    //multiply, add and divide over the packed column rays
+    const float * columnRays = &rayX[ roi.x ];
+    for ( int r = 0; r < roi.height; r ++ ){
+        const float rowTerm = B * rayY[ roi.y + r ] + C;
+        float * z = depths.ptr< float >( r );
+        for ( int c = 0; c < roi.width; c ++ ){
+            z[c] = - D / ( A * columnRays[c] + rowTerm );
+        }
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef RAY_TABLE
+#define RAY_TABLE
+
+#include <vector>
+
+#include <pcl/point_types.h>
+#include <pcl/ModelCoefficients.h>
+
+#include "opencv2/core/core.hpp"
+
+//RayTable back-projects pixels of a pinhole camera onto planes.
+//
+//The ray through pixel (u, v) is ( (u - u0) / fx, (v - v0) / fy, 1 ), so
+//the ray directions of a frame are kept as one table per axis: one entry
+//per column and one per row. A pixel's ray is then two lookups, and the
+//pixels of a row share their y direction, so the depths of a whole row of
+//a region are one pass over the column table that the compiler can
+//vectorize.
+//
+//The plane is Ax + By + Cz + D = 0, and a pixel lands at z = -D / ( A rx +
+//B ry + C ). Pixels outside the table are still projected, their ray is just
+//worked out instead of looked up. A table is only read while projecting,
+//so several threads can project with the same one.
+class RayTable
+{
+public:
+    typedef std::vector< cv::Vec4i > LineArray;
+    typedef std::vector< pcl::PointXYZ > LinePosArray;
+
+    RayTable();
+
+    void setIntrinsics( float fx, float fy, float u0, float v0 );
+
+    //the size of the frames, which is how far the tables go.
+    void setSize( int width, int height );
+
+    int width() const { return rayX.size(); }
+    int height() const { return rayY.size(); }
+
+    //the point of the plane seen at pixel (u, v)
+    pcl::PointXYZ project( const pcl::ModelCoefficients & plane,
+                           int u, int v ) const;
+
+    //appends the points of the plane seen at the two endpoints of every
+    //line, in order.
+    void projectLines( const pcl::ModelCoefficients & plane,
+                       const LineArray & lines,
+                       LinePosArray & positions ) const;
+
+    //the depth of the plane at every pixel of roi, as a roi sized CV_32F
+    //image. The point of the plane seen at a pixel is ( rx z, ry z, z ).
+    //depths keeps its buffer if it is already the size of roi. roi has to
+    //be inside the table.
+    void projectRegion( const pcl::ModelCoefficients & plane,
+                        const cv::Rect & roi, cv::Mat & depths ) const;
+
+private:
+    float fx, fy, u0, v0;
+    std::vector< float > rayX, rayY;
+
+    void makeTables();
+
+    float rayAtColumn( int u ) const {
+        return u >= 0 && u < width() ? rayX[u] : ( u - u0 ) / fx;
+    }
+    float rayAtRow( int v ) const {
+        return v >= 0 && v < height() ? rayY[v] : ( v - v0 ) / fy;
+    }
+};
+
+#endif
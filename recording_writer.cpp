@@ -0,0 +1,165 @@
+#include "recording_writer.h"
+
+#include <algorithm>
+
+#include <pcl/io/pcd_io.h>
+#include <pcl/common/time.h>
+
+#include <boost/bind.hpp>
+#include <boost/exception/to_string.hpp>
+
+
+RecordingWriter::RecordingWriter() :
+        capacity( 0 ), format( PCD_BINARY ), fileIndex( 0 ),
+        stopping( false ), numPushed( 0 ), numWritten( 0 ), numDropped( 0 ),
+        numFailed( 0 ), backlog( 0 ), maxBacklog( 0 )
+{
+}
+
+RecordingWriter::~RecordingWriter()
+{
+    stop();
+}
+
+bool RecordingWriter::start( const std::string & name, Format format,
+                             size_t capacity )
+{
+    stop();
+    this->name = name;
+    this->format = format;
+    this->capacity = std::max< size_t >( capacity, 1 );
+    fileIndex = 0;
+
+    if ( format == FRAMES || format == FRAMES_LZF ){
+        const std::string file = name + ".frames";
+        if ( !frameFile.open( file, format == FRAMES_LZF ?
+                                    frame_file::LZF : frame_file::NONE ) ){
+            std::cerr << "error opening " << file << "\n";
+            return false;
+        }
+    }
+
+    ring.reset( new boost::lockfree::spsc_queue< queued_frame * >(
+                                                        this->capacity ) );
+    stopping = false;
+    writerThread.reset( new boost::thread(
+                    boost::bind( &RecordingWriter::writerLoop, this ) ) );
+    return true;
+}
+
+void RecordingWriter::stop()
+{
+    if ( !writerThread ){
+        return;
+    }
+    {
+        boost::mutex::scoped_lock lock( waitMutex );
+        stopping = true;
+    }
+    frameReady.notify_one();
+    writerThread->join();
+    writerThread.reset();
+    frameFile.close();
+}
+
+//runs on the grabber thread
+void RecordingWriter::push( const PointCloud::ConstPtr & cloud )
+{
+    numPushed ++;
+    queued_frame * frame = new queued_frame;
+    frame->cloud = cloud;
+    frame->timestamp = boost::uint64_t( pcl::getTime() * 1e6 );
+
+    //the backlog is counted before the push, so that the writer thread
+    //never takes it below zero.
+    const unsigned long depth = ++ backlog;
+    if ( !ring->push( frame ) ){
+        backlog --;
+        delete frame;
+        numDropped ++;
+        return;
+    }
+
+    unsigned long deepest = maxBacklog;
+    while ( depth > deepest &&
+            !maxBacklog.compare_exchange_weak( deepest, depth ) );
+
+    //the lock makes sure a writer that just found the ring empty is
+    //already waiting
+    {
+        boost::mutex::scoped_lock lock( waitMutex );
+    }
+    frameReady.notify_one();
+}
+
+void RecordingWriter::writerLoop()
+{
+    while ( true ){
+        queued_frame * frame;
+        if ( !ring->pop( frame ) ){
+            //the ring is only left once it has been emptied after stop
+            boost::mutex::scoped_lock lock( waitMutex );
+            while ( !ring->read_available() && !stopping ){
+                frameReady.wait( lock );
+            }
+            if ( !ring->read_available() ){
+                return;
+            }
+            continue;
+        }
+        backlog --;
+
+        if ( write( *frame ) ){
+            numWritten ++;
+        } else {
+            numFailed ++;
+        }
+        delete frame;
+    }
+}
+
+bool RecordingWriter::write( const queued_frame & frame )
+{
+    if ( format == FRAMES || format == FRAMES_LZF ){
+        return frameFile.write( *frame.cloud, frame.timestamp );
+    }
+
+    const std::string file = name + boost::to_string( fileIndex ++ ) + ".pcd";
+    try {
+        pcl::PCDWriter writer;
+        const int status = format == PCD_COMPRESSED ?
+                           writer.writeBinaryCompressed( file, *frame.cloud ) :
+                           writer.writeBinary( file, *frame.cloud );
+        if ( status != 0 ){
+            std::cerr << "error writing " << file << "\n";
+            return false;
+        }
+    }
+    catch ( std::exception & e ){
+        std::cerr << "error writing " << file << ": " << e.what() << "\n";
+        return false;
+    }
+    return true;
+}
+
+RecordingWriter::counters RecordingWriter::getCounters() const
+{
+    counters c;
+    c.pushed = numPushed;
+    c.written = numWritten;
+    c.dropped = numDropped;
+    c.failed = numFailed;
+    c.backlog = backlog;
+    c.maxBacklog = maxBacklog;
+    return c;
+}
+
+void RecordingWriter::printCounters( std::ostream & ostr ) const
+{
+    const counters c = getCounters();
+    ostr << "frames recorded: " << c.written << " of " << c.pushed
+         << " (" << c.dropped << " dropped with the ring full, "
+         << c.failed << " failed to write)\n"
+         << "recording backlog: " << c.backlog << " now, " << c.maxBacklog
+         << " at most, of " << capacity << "\n";
+}
@@ -0,0 +1,101 @@
+#ifndef RECORDING_WRITER
+#define RECORDING_WRITER
+
+#include <string>
+#include <iostream>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+
+#include "frame_file.h"
+
+//RecordingWriter saves the frames of a live camera on a thread of its own,
+//so that the grabber thread never waits on the disk.
+//
+//push only puts the cloud in a bounded ring, without copying it, and wakes
+//the writer thread, which sleeps while the ring is empty. The writer
+//thread takes the frames out in order and writes them. If the disk
+//falls so far behind that the ring is full, the new frame is dropped and
+//counted, the grabber is never held up. The deepest the ring has been is
+//kept as a measure of how close the disk came to not keeping up.
+class RecordingWriter : private boost::noncopyable
+{
+public:
+    typedef pcl::PointXYZRGBA Point;
+    typedef pcl::PointCloud<Point> PointCloud;
+
+    //the ways the frames can be saved
+    enum Format {
+        PCD_BINARY = 0,        //<name><index>.pcd, binary
+        PCD_COMPRESSED = 1,    //<name><index>.pcd, binary_compressed
+        FRAMES = 2,            //one <name>.frames frame file
+        FRAMES_LZF = 3         //one <name>.frames frame file, lzf packed
+    };
+
+    struct counters {
+        unsigned long pushed;     //frames handed to push
+        unsigned long written;
+        unsigned long dropped;    //frames that found the ring full
+        unsigned long failed;     //frames that could not be written
+        unsigned long backlog;    //frames waiting in the ring right now
+        unsigned long maxBacklog; //the deepest the ring has been
+    };
+
+    RecordingWriter();
+    ~RecordingWriter();
+
+    //starts the writer thread, with room for capacity frames in the ring.
+    //name is the prefix of the pcd files, or the frame file without its
+    //.frames extension. returns false if the frame file can not be created.
+    bool start( const std::string & name, Format format,
+                size_t capacity=60 );
+
+    //writes the frames that are still in the ring, then stops the thread.
+    void stop();
+
+    bool isRunning() const { return bool( writerThread ); }
+
+    //hands a frame to the writer thread. Never blocks. Only one thread
+    //may push, and only while the writer is running.
+    void push( const PointCloud::ConstPtr & cloud );
+
+    counters getCounters() const;
+    void printCounters( std::ostream & ostr ) const;
+
+private:
+    struct queued_frame {
+        PointCloud::ConstPtr cloud;
+        boost::uint64_t timestamp;   //microseconds, when it was pushed
+    };
+
+    boost::scoped_ptr< boost::lockfree::spsc_queue< queued_frame * > > ring;
+    size_t capacity;
+    std::string name;
+    Format format;
+    int fileIndex;                    //the number of the next pcd file
+    FrameFileWriter frameFile;
+
+    boost::shared_ptr< boost::thread > writerThread;
+    boost::atomic< bool > stopping;
+
+    //the writer thread waits on frameReady while the ring is empty. push
+    //only takes the lock long enough to wake it.
+    boost::mutex waitMutex;
+    boost::condition_variable frameReady;
+    boost::atomic< unsigned long > numPushed, numWritten, numDropped,
+                                   numFailed, backlog, maxBacklog;
+
+    void writerLoop();
+    bool write( const queued_frame & frame );
+};
+
+#endif
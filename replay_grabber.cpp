@@ -0,0 +1,229 @@
+#include "replay_grabber.h"
+
+#include <algorithm>
+
+#include <pcl/io/pcd_io.h>
+#include <pcl/common/time.h>
+
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+
+ReplayGrabber::ReplayGrabber() :
+        cloudSignal( NULL ), isFrameFile( false ), pacing( REAL_TIME ),
+        rate( 30 ), repeat( false ), readAhead( 4 ), stopping( false ),
+        running( false ), numDelivered( 0 ), numLate( 0 ), numFailed( 0 ),
+        maxLatenessUs( 0 ), startTime( 0 ), endTime( 0 )
+{
+    cloudSignal = createSignal< cloud_callback >();
+}
+
+ReplayGrabber::~ReplayGrabber()
+{
+    stop();
+    disconnect_all_slots< cloud_callback >();
+}
+
+bool ReplayGrabber::open( const std::string & source )
+{
+    stop();
+    this->source = source;
+    pcdFiles.clear();
+    frameFile.close();
+
+    const std::string extension = ".frames";
+    isFrameFile = source.size() > extension.size() &&
+        source.compare( source.size() - extension.size(),
+                        extension.size(), extension ) == 0;
+
+    if ( isFrameFile ){
+        return frameFile.open( source );
+    }
+
+    frame_file::listPcdFiles( source, pcdFiles );
+    if ( pcdFiles.empty() ){
+        std::cerr << "no pcd files found for " << source << "\n";
+        return false;
+    }
+    return true;
+}
+
+void ReplayGrabber::setPacing( Pacing pacing, double rate )
+{
+    this->pacing = pacing;
+    this->rate = rate > 0 ? rate : 30;
+}
+
+size_t ReplayGrabber::numFrames() const
+{
+    return isFrameFile ? frameFile.numFrames() : pcdFiles.size();
+}
+
+void ReplayGrabber::start()
+{
+    stop();
+    if ( numFrames() == 0 ){
+        return;
+    }
+
+    numDelivered = 0;
+    numLate = 0;
+    numFailed = 0;
+    maxLatenessUs = 0;
+    stopping = false;
+    running = true;
+    startTime = endTime = pcl::getTime();
+
+    if ( isFrameFile ){
+        frameFile.setReadAhead( readAhead );
+    }
+    replayThread.reset( new boost::thread(
+                    boost::bind( &ReplayGrabber::replayLoop, this ) ) );
+}
+
+void ReplayGrabber::stop()
+{
+    if ( !replayThread ){
+        return;
+    }
+    stopping = true;
+    replayThread->join();
+    replayThread.reset();
+    if ( isFrameFile ){
+        frameFile.setReadAhead( 0 );
+    }
+}
+
+bool ReplayGrabber::isRunning() const
+{
+    return running;
+}
+
+float ReplayGrabber::getFramesPerSecond() const
+{
+    if ( pacing == UNTHROTTLED ){
+        return 0;
+    }
+    if ( pacing == REAL_TIME && isFrameFile && numFrames() > 1 ){
+        const double duration = interval( 0, numFrames() - 1 );
+        if ( duration > 0 ){
+            return float( ( numFrames() - 1 ) / duration );
+        }
+    }
+    return float( rate );
+}
+
+void ReplayGrabber::replayLoop()
+{
+    //every pass keeps its own schedule, which starts once the first of
+    //its frames that can be read has been. A pass that could not read any
+    //frame ends the replay.
+    bool started;
+    do {
+        started = false;
+        double due = 0;
+        size_t last = 0;
+
+        for ( size_t i = 0; i < numFrames() && !stopping; i ++ ){
+            PointCloud::Ptr cloud = readFrame( i );
+            if ( !cloud ){
+                numFailed ++;
+                continue;
+            }
+            if ( !started ){
+                started = true;
+                due = pcl::getTime();
+            } else {
+                due += interval( last, i );
+            }
+            last = i;
+
+            if ( pacing != UNTHROTTLED && !sleepUntil( due ) ){
+                break;
+            }
+
+            const double lateness = pcl::getTime() - due;
+            if ( pacing != UNTHROTTLED && lateness > 0.001 ){
+                const long us = long( lateness * 1e6 );
+                numLate ++;
+                long latest = maxLatenessUs;
+                while ( us > latest &&
+                        !maxLatenessUs.compare_exchange_weak( latest, us ) );
+            }
+
+            ( *cloudSignal )( cloud );
+            numDelivered ++;
+        }
+    } while ( repeat && started && !stopping );
+
+    endTime = pcl::getTime();
+    running = false;
+}
+
+ReplayGrabber::PointCloud::Ptr ReplayGrabber::readFrame( size_t i )
+{
+    if ( isFrameFile ){
+        return frameFile.get( i );
+    }
+
+    PointCloud::Ptr cloud( new PointCloud );
+    try {
+        if ( pcl::io::loadPCDFile< Point >( pcdFiles[i], *cloud ) == -1 ){
+            std::cerr << "Couldn't read file " << pcdFiles[i] << "\n";
+            return PointCloud::Ptr();
+        }
+    }
+    catch ( std::exception & e ){
+        std::cerr << "Error reading " << pcdFiles[i] << ": " << e.what()
+                  << "\n";
+        return PointCloud::Ptr();
+    }
+    return cloud;
+}
+
+double ReplayGrabber::interval( size_t from, size_t to ) const
+{
+    //frames whose timestamps do not go forward are played at the rate
+    if ( pacing == REAL_TIME && isFrameFile &&
+         frameFile.timestamp( to ) > frameFile.timestamp( from ) ){
+        return ( frameFile.timestamp( to ) - frameFile.timestamp( from ) ) *
+               1e-6;
+    }
+    return ( to - from ) / rate;
+}
+
+bool ReplayGrabber::sleepUntil( double time ) const
+{
+    //sleeps in short steps, so that stop never waits for a long gap in
+    //the recording
+    while ( !stopping ){
+        const double remaining = time - pcl::getTime();
+        if ( remaining <= 0 ){
+            return true;
+        }
+        const long us = long( std::min( remaining, 0.005 ) * 1e6 );
+        boost::this_thread::sleep( boost::posix_time::microseconds( us ) );
+    }
+    return false;
+}
+
+ReplayGrabber::counters ReplayGrabber::getCounters() const
+{
+    counters c;
+    c.delivered = numDelivered;
+    c.late = numLate;
+    c.failed = numFailed;
+    c.maxLateness = maxLatenessUs * 1e-6;
+    c.elapsed = ( running ? pcl::getTime() : endTime ) - startTime;
+    return c;
+}
+
+void ReplayGrabber::printCounters( std::ostream & ostr ) const
+{
+    const counters c = getCounters();
+    ostr << "frames replayed: " << c.delivered << " in " << c.elapsed
+         << " s (" << ( c.elapsed > 0 ? c.delivered / c.elapsed : 0 )
+         << " frames/sec, " << c.failed << " could not be read)\n"
+         << "frames replayed late: " << c.late << ", by at most "
+         << c.maxLateness * 1000 << " ms\n";
+}
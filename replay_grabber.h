@@ -0,0 +1,125 @@
+#ifndef REPLAY_GRABBER
+#define REPLAY_GRABBER
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+#include <pcl/io/grabber.h>
+
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/signals2.hpp>
+
+#include "frame_file.h"
+
+//ReplayGrabber stands in for the camera grabber. It plays a recording
+//back through the same point cloud callback the OpenNIGrabber calls, on a
+//thread of its own, so the live pipeline can be run without a camera.
+//
+//The recording is a frame file, or a sequence of pcd files as in
+//frame_file::listPcdFiles. The frames can be paced:
+//  REAL_TIME    by the timestamps stored with the frames. pcd files have
+//               none, so they are played at the rate instead, and so are
+//               frames whose timestamp is not after the one before.
+//  FIXED_RATE   at rate frames per second.
+//  UNTHROTTLED  as fast as they can be read.
+//
+//Each frame is read before it is due, and handed to the callbacks when it
+//is. The schedule is kept from the start of the replay, so a frame that
+//is late does not delay the ones after it. A frame is late if it is
+//handed over more than a millisecond after it was due, because it took
+//too long to read or the callbacks of the frame before it took too long
+//to return.
+class ReplayGrabber : public pcl::Grabber, private boost::noncopyable
+{
+public:
+    typedef pcl::PointXYZRGBA Point;
+    typedef pcl::PointCloud<Point> PointCloud;
+    typedef void ( cloud_callback )( const PointCloud::ConstPtr & );
+
+    enum Pacing {
+        REAL_TIME = 0,
+        FIXED_RATE = 1,
+        UNTHROTTLED = 2
+    };
+
+    struct counters {
+        unsigned long delivered;   //frames handed to the callbacks
+        unsigned long late;        //frames handed over after they were due
+        unsigned long failed;      //frames that could not be read
+        double maxLateness;        //seconds, the latest a frame has been
+        double elapsed;            //seconds since the replay started
+    };
+
+    ReplayGrabber();
+    virtual ~ReplayGrabber();
+
+    //finds the frames of a recording. returns false, with a message on
+    //cerr, if there are none.
+    bool open( const std::string & source );
+
+    //rate is in frames per second, for FIXED_RATE and for pcd files
+    //played in REAL_TIME.
+    void setPacing( Pacing pacing, double rate=30 );
+
+    //plays the recording over and over until stop is called.
+    void setRepeat( bool repeat ) { this->repeat = repeat; }
+
+    //the frames of a frame file that are decoded ahead of the replay
+    void setReadAhead( int frames ) { readAhead = frames; }
+
+    size_t numFrames() const;
+
+    //starts the replay thread. The replay stops by itself at the end of
+    //the recording, unless it repeats.
+    virtual void start();
+    virtual void stop();
+    virtual bool isRunning() const;
+    virtual std::string getName() const { return "ReplayGrabber"; }
+
+    //the rate the frames are paced at, 0 if they are not
+    virtual float getFramesPerSecond() const;
+
+    counters getCounters() const;
+    void printCounters( std::ostream & ostr ) const;
+
+private:
+    boost::signals2::signal< cloud_callback > * cloudSignal;
+
+    std::string source;
+    bool isFrameFile;
+    FrameFileReader frameFile;
+    std::vector< std::string > pcdFiles;
+
+    Pacing pacing;
+    double rate;
+    bool repeat;
+    int readAhead;
+
+    boost::shared_ptr< boost::thread > replayThread;
+    boost::atomic< bool > stopping, running;
+    boost::atomic< unsigned long > numDelivered, numLate, numFailed;
+    boost::atomic< long > maxLatenessUs;
+    double startTime, endTime;
+
+    void replayLoop();
+
+    //reads frame i of the recording. returns an empty pointer if it can
+    //not be read.
+    PointCloud::Ptr readFrame( size_t i );
+
+    //the seconds from frame from to frame to of the recording, by their
+    //timestamps, or by the rate if they have none or go backwards
+    double interval( size_t from, size_t to ) const;
+
+    //sleeps until time, in pcl::getTime seconds. returns false if the
+    //replay was stopped in the mean time.
+    bool sleepUntil( double time ) const;
+};
+
+#endif
@@ -0,0 +1,246 @@
+#include "result_io.h"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <boost/static_assert.hpp>
+
+//the layout of the file depends on these sizes
+BOOST_STATIC_ASSERT( sizeof( float ) == 4 );
+BOOST_STATIC_ASSERT( sizeof( result_file_header ) == 16 );
+BOOST_STATIC_ASSERT( sizeof( result_frame_header ) == 32 );
+BOOST_STATIC_ASSERT( sizeof( result_plane ) == 48 );
+BOOST_STATIC_ASSERT( sizeof( result_line ) == 40 );
+
+static bool isLittleEndian()
+{
+    const boost::uint32_t one = 1;
+    return *reinterpret_cast< const unsigned char * >( &one ) == 1;
+}
+
+
+ResultWriter::ResultWriter() : file( NULL )
+{
+}
+
+ResultWriter::~ResultWriter()
+{
+    close();
+}
+
+bool ResultWriter::open( const std::string & fileName )
+{
+    close();
+    file = fopen( fileName.c_str(), "wb" );
+    if ( file == NULL ){
+        return false;
+    }
+
+    buffer.assign( sizeof( result_file_header ), 0 );
+    memcpy( &buffer[0], result_io::FILE_MAGIC, 8 );
+    put32( 8, result_io::VERSION );
+    put32( 12, sizeof( result_file_header ) );
+    if ( fwrite( &buffer[0], 1, buffer.size(), file ) != buffer.size() ){
+        close();
+        return false;
+    }
+    return true;
+}
+
+void ResultWriter::close()
+{
+    if ( file != NULL ){
+        fclose( file );
+        file = NULL;
+    }
+}
+
+//the fields are put in byte by byte, so the file comes out little-endian
+//on any host.
+void ResultWriter::put32( size_t offset, boost::uint32_t value )
+{
+    for ( int i = 0; i < 4; i ++ ){
+        buffer[ offset + i ] = ( value >> ( 8 * i ) ) & 0xff;
+    }
+}
+
+void ResultWriter::put64( size_t offset, boost::uint64_t value )
+{
+    for ( int i = 0; i < 8; i ++ ){
+        buffer[ offset + i ] = ( value >> ( 8 * i ) ) & 0xff;
+    }
+}
+
+void ResultWriter::putFloat( size_t offset, float value )
+{
+    boost::uint32_t bits;
+    memcpy( &bits, &value, 4 );
+    put32( offset, bits );
+}
+
+bool ResultWriter::write( const SegmentationResult & result,
+                          unsigned int frame, boost::uint64_t timestamp )
+{
+    if ( file == NULL ){
+        return false;
+    }
+
+    //a line is only written if both its pixels and its ends are known
+    std::vector< boost::uint32_t > numDepth( result.size() );
+    std::vector< boost::uint32_t > numIntensity( result.size() );
+    size_t numLines = 0;
+    for ( size_t i = 0; i < result.size(); i ++ ){
+        const plane_data & plane = result[i];
+        numDepth[i] = std::min( plane.depthPixels.size(),
+                                plane.depthLines.size() / 2 );
+        numIntensity[i] = std::min( plane.intensityPixels.size(),
+                                    plane.intensityLines.size() / 2 );
+        numLines += numDepth[i] + numIntensity[i];
+    }
+
+    const size_t planeStart = sizeof( result_frame_header );
+    const size_t lineStart = planeStart +
+                             result.size() * sizeof( result_plane );
+    const size_t size = lineStart + numLines * sizeof( result_line );
+    buffer.assign( size, 0 );
+
+    put32( 0, result_io::FRAME_MAGIC );
+    put32( 4, size );
+    put64( 8, timestamp );
+    put32( 16, frame );
+    put32( 20, result.size() );
+    put32( 24, numLines );
+
+    size_t line = 0;
+    for ( size_t i = 0; i < result.size(); i ++ ){
+        const plane_data & plane = result[i];
+        const size_t p = planeStart + i * sizeof( result_plane );
+
+        for ( size_t j = 0; j < 4; j ++ ){
+            putFloat( p + 4 * j, j < plane.coeffs.values.size() ?
+                                 plane.coeffs.values[j] : 0.0f );
+        }
+        put32( p + 16, plane.numPixels );
+        put32( p + 20, plane.bbox.x );
+        put32( p + 24, plane.bbox.y );
+        put32( p + 28, plane.bbox.width );
+        put32( p + 32, plane.bbox.height );
+        put32( p + 36, line );
+        put32( p + 40, numDepth[i] );
+        put32( p + 44, numIntensity[i] );
+
+        for ( int k = 0; k < 2; k ++ ){
+            const std::vector< cv::Vec4i > & pixels =
+                            k == 0 ? plane.depthPixels : plane.intensityPixels;
+            const std::vector< pcl::PointXYZ > & ends =
+                            k == 0 ? plane.depthLines : plane.intensityLines;
+            const size_t n = k == 0 ? numDepth[i] : numIntensity[i];
+
+            for ( size_t j = 0; j < n; j ++, line ++ ){
+                const size_t l = lineStart + line * sizeof( result_line );
+                for ( int c = 0; c < 4; c ++ ){
+                    put32( l + 4 * c, pixels[j][c] );
+                }
+                const pcl::PointXYZ & a = ends[ 2 * j ];
+                const pcl::PointXYZ & b = ends[ 2 * j + 1 ];
+                putFloat( l + 16, a.x );
+                putFloat( l + 20, a.y );
+                putFloat( l + 24, a.z );
+                putFloat( l + 28, b.x );
+                putFloat( l + 32, b.y );
+                putFloat( l + 36, b.z );
+            }
+        }
+    }
+
+    return fwrite( &buffer[0], 1, size, file ) == size;
+}
+
+
+ResultReader::ResultReader() : data( NULL ), length( 0 )
+{
+}
+
+ResultReader::~ResultReader()
+{
+    close();
+}
+
+bool ResultReader::open( const std::string & fileName )
+{
+    close();
+
+    //the records are used in place, so they have to be in the byte order
+    //of the host.
+    if ( !isLittleEndian() ){
+        std::cerr << "result files can only be read on little-endian hosts\n";
+        return false;
+    }
+
+    const int fd = ::open( fileName.c_str(), O_RDONLY );
+    if ( fd < 0 ){
+        std::cerr << "error opening " << fileName << "\n";
+        return false;
+    }
+    struct stat info;
+    if ( fstat( fd, &info ) != 0 ||
+         size_t( info.st_size ) < sizeof( result_file_header ) ){
+        std::cerr << fileName << " is not a result file\n";
+        ::close( fd );
+        return false;
+    }
+    length = info.st_size;
+    void * mapping = mmap( NULL, length, PROT_READ, MAP_SHARED, fd, 0 );
+    ::close( fd );
+    if ( mapping == MAP_FAILED ){
+        std::cerr << "error mapping " << fileName << "\n";
+        length = 0;
+        return false;
+    }
+    data = static_cast< const unsigned char * >( mapping );
+
+    const result_file_header & header =
+                    *reinterpret_cast< const result_file_header * >( data );
+    if ( memcmp( header.magic, result_io::FILE_MAGIC, 8 ) != 0 ||
+         header.version != result_io::VERSION ||
+         header.headerSize < sizeof( result_file_header ) ||
+         header.headerSize % 8 != 0 ){
+        std::cerr << fileName << " is not a version " << result_io::VERSION
+                  << " result file\n";
+        close();
+        return false;
+    }
+
+    //hop from record to record. A record that was cut short, by a writer
+    //that did not finish, ends the file.
+    size_t offset = header.headerSize;
+    while ( offset + sizeof( result_frame_header ) <= length ){
+        const result_frame_header & frame =
+            *reinterpret_cast< const result_frame_header * >( data + offset );
+        const size_t needed = sizeof( result_frame_header ) +
+                              size_t( frame.numPlanes ) * sizeof( result_plane ) +
+                              size_t( frame.numLines ) * sizeof( result_line );
+        if ( frame.magic != result_io::FRAME_MAGIC || frame.size % 8 != 0 ||
+             frame.size < needed || offset + frame.size > length ){
+            std::cerr << fileName << " ends in a broken record after "
+                      << records.size() << " frames\n";
+            break;
+        }
+        records.push_back( data + offset );
+        offset += frame.size;
+    }
+    return true;
+}
+
+void ResultReader::close()
+{
+    if ( data != NULL ){
+        munmap( const_cast< unsigned char * >( data ), length );
+        data = NULL;
+    }
+    length = 0;
+    records.clear();
+}
@@ -0,0 +1,130 @@
+#ifndef RESULT_IO
+#define RESULT_IO
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+
+#include <boost/cstdint.hpp>
+
+#include "plane_segmenter.h"
+
+//The segmentation results of a sequence of frames can be kept in a result
+//file, one record per frame, at a small fraction of the size of the clouds.
+//
+//Everything in the file is little-endian, and every record is laid out so
+//that it can be used in place once the file is memory-mapped:
+//
+//  file header      result_file_header
+//  per frame        result_frame_header
+//                   numPlanes x result_plane
+//                   numLines x result_line, the depth lines and then the
+//                   intensity lines of each plane, in plane order
+//
+//Every struct is a multiple of 8 bytes long and holds nothing but 4 and 8
+//byte fields, so the records stay aligned one after another. A reader that
+//does not know a later version can still skip records with their size.
+
+namespace result_io
+{
+    static const char FILE_MAGIC[8] = { 'D', 'O', 'O', 'R', 'S', 'E', 'G', 0 };
+    static const boost::uint32_t VERSION = 1;
+    static const boost::uint32_t FRAME_MAGIC = 0x454d5246;   //"FRME"
+}
+
+struct result_file_header {
+    char magic[8];
+    boost::uint32_t version;
+    boost::uint32_t headerSize;    //bytes from the start of the file to the
+                                   //first record
+};
+
+struct result_frame_header {
+    boost::uint32_t magic;
+    boost::uint32_t size;          //bytes in the whole record, this header
+                                   //included
+    boost::uint64_t timestamp;     //microseconds
+    boost::uint32_t frame;         //the number of the frame in its sequence
+    boost::uint32_t numPlanes;
+    boost::uint32_t numLines;
+    boost::uint32_t reserved;
+};
+
+struct result_plane {
+    float coeffs[4];               //Ax + By + Cz + D = 0
+    boost::int32_t numPixels;
+    boost::int32_t bbox[4];        //x, y, width, height in pixels
+    boost::uint32_t firstLine;     //the record's first line of the plane
+    boost::uint32_t numDepthLines;
+    boost::uint32_t numIntensityLines;
+};
+
+struct result_line {
+    boost::int32_t pixels[4];      //u0, v0, u1, v1 in the image
+    float start[3], end[3];        //the ends in space, in meters
+};
+
+//appends the results of frames to a result file. A writer is not thread
+//safe, several threads have to take turns.
+class ResultWriter : private boost::noncopyable
+{
+public:
+    ResultWriter();
+    ~ResultWriter();
+
+    //creates the file, replacing any file of the same name.
+    //returns false if it can not be written.
+    bool open( const std::string & fileName );
+    void close();
+    bool isOpen() const { return file != NULL; }
+
+    //writes one frame. returns false if the write failed.
+    bool write( const SegmentationResult & result, unsigned int frame,
+                boost::uint64_t timestamp );
+
+private:
+    FILE * file;
+    std::vector< unsigned char > buffer;   //the record being written
+
+    void put32( size_t offset, boost::uint32_t value );
+    void put64( size_t offset, boost::uint64_t value );
+    void putFloat( size_t offset, float value );
+};
+
+//reads a result file by mapping it into memory. The frames are found by
+//hopping from record to record when the file is opened, and after that
+//every field is read straight out of the mapping. The records are only
+//valid until the reader is closed.
+class ResultReader : private boost::noncopyable
+{
+public:
+    ResultReader();
+    ~ResultReader();
+
+    //maps the file and finds its frames. returns false, with a message on
+    //cerr, if it is not a result file this reader can read.
+    bool open( const std::string & fileName );
+    void close();
+
+    size_t numFrames() const { return records.size(); }
+
+    const result_frame_header & frame( size_t i ) const {
+        return *reinterpret_cast< const result_frame_header * >( records[i] );
+    }
+    const result_plane * planes( size_t i ) const {
+        return reinterpret_cast< const result_plane * >(
+                                records[i] + sizeof( result_frame_header ) );
+    }
+    const result_line * lines( size_t i ) const {
+        return reinterpret_cast< const result_line * >(
+                    records[i] + sizeof( result_frame_header ) +
+                    frame( i ).numPlanes * sizeof( result_plane ) );
+    }
+
+private:
+    const unsigned char * data;
+    size_t length;
+    std::vector< const unsigned char * > records;
+};
+
+#endif
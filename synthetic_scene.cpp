@@ -0,0 +1,364 @@
+#include "synthetic_scene.h"
+
+#include <math.h>
+#include <limits>
+#include <algorithm>
+
+#include <Eigen/Geometry>
+#include <boost/random/uniform_real.hpp>
+#include <boost/random/normal_distribution.hpp>
+#include <boost/random/variate_generator.hpp>
+
+
+double scene_accuracy::planeRecall() const
+{
+    return truePlanes > 0 ? double( matchedPlanes ) / truePlanes : 1.0;
+}
+
+double scene_accuracy::planePrecision() const
+{
+    return foundPlanes > 0 ? double( matchedPlanes ) / foundPlanes : 1.0;
+}
+
+double scene_accuracy::lineRecall() const
+{
+    return trueLines > 0 ? double( recalledLines ) / trueLines : 1.0;
+}
+
+double scene_accuracy::linePrecision() const
+{
+    return foundLines > 0 ? double( preciseLines ) / foundLines : 1.0;
+}
+
+
+//the distance from a point to a line segment
+static float segmentDistance( const Eigen::Vector3f & p,
+                              const Eigen::Vector3f & a,
+                              const Eigen::Vector3f & b )
+{
+    const Eigen::Vector3f ab = b - a;
+    const float len2 = ab.squaredNorm();
+    float t = len2 > 0 ? ( p - a ).dot( ab ) / len2 : 0;
+    t = std::max( 0.0f, std::min( 1.0f, t ) );
+    return ( a + t * ab - p ).norm();
+}
+
+
+SyntheticScene::SyntheticScene( int width, int height, float focalLength )
+                      : width( width ), height( height ),
+                        focalLength( focalLength ),
+                        u0( width / 2 ), v0( height / 2 ),
+                        depthNoise( true ), holeFraction( 0.02 ),
+                        doorSpacing( 2 )
+{
+}
+
+void SyntheticScene::setNoise( bool depthNoise, float holeFraction )
+{
+    this->depthNoise = depthNoise;
+    this->holeFraction = holeFraction;
+}
+
+void SyntheticScene::setDoorSpacing( int doorSpacing )
+{
+    this->doorSpacing = doorSpacing;
+}
+
+float SyntheticScene::uniform( float low, float high )
+{
+    boost::uniform_real< float > dist( low, high );
+    boost::variate_generator< boost::mt19937 &, boost::uniform_real< float > >
+        gen( rng, dist );
+    return gen();
+}
+
+float SyntheticScene::gaussian( float sigma )
+{
+    boost::normal_distribution< float > dist( 0, sigma );
+    boost::variate_generator< boost::mt19937 &,
+                              boost::normal_distribution< float > >
+        gen( rng, dist );
+    return gen();
+}
+
+Eigen::Vector3f SyntheticScene::ray( float u, float v ) const
+{
+    return Eigen::Vector3f( ( u - u0 ) / focalLength,
+                            ( v - v0 ) / focalLength,
+                            1.0f );
+}
+
+Eigen::Vector3f SyntheticScene::intersect( const Eigen::Vector4f & coeffs,
+                                           float u, float v ) const
+{
+    const Eigen::Vector3f r = ray( u, v );
+    const float t = -coeffs[3] / coeffs.head< 3 >().dot( r );
+    return r * t;
+}
+
+void SyntheticScene::generate( int numPlanes, unsigned int seed,
+                               PointCloud & cloud )
+{
+    rng.seed( seed );
+    truthPlanes.clear();
+    truthLines.clear();
+
+    const float nan = std::numeric_limits< float >::quiet_NaN();
+
+    cloud.width = width;
+    cloud.height = height;
+    cloud.is_dense = false;
+    cloud.points.resize( width * height );
+    for ( size_t i = 0; i < cloud.points.size(); i ++ ){
+        Point & p = cloud.points[i];
+        p.x = p.y = p.z = nan;
+        p.r = p.g = p.b = 0;
+        p.a = 255;
+    }
+
+    if ( numPlanes <= 0 ){
+        return;
+    }
+
+    //lay the planes out on a grid with roughly the aspect of the image.
+    int cols = std::max( 1, int( ceil( sqrt( numPlanes * float( width )
+                                                        / height ) ) ) );
+    cols = std::min( cols, numPlanes );
+    const int rows = ( numPlanes + cols - 1 ) / cols;
+
+    const int cellWidth = width / cols;
+    const int cellHeight = height / rows;
+    const int gapX = std::max( 4, cellWidth / 20 );
+    const int gapY = std::max( 4, cellHeight / 20 );
+
+    for ( int k = 0; k < numPlanes; k ++ ){
+        truth_plane plane;
+
+        const int col = k % cols;
+        const int row = k / cols;
+        plane.region = cv::Rect( col * cellWidth + gapX, row * cellHeight + gapY,
+                                 cellWidth - 2 * gapX, cellHeight - 2 * gapY );
+
+        //tilt the plane away from facing the camera, and stagger the depth
+        //so that neighbouring planes are never coplanar.
+        const float yaw = uniform( -0.6, 0.6 );
+        const float pitch = uniform( -0.4, 0.4 );
+        const Eigen::Vector3f normal =
+            ( Eigen::AngleAxisf( yaw, Eigen::Vector3f::UnitY() ) *
+              Eigen::AngleAxisf( pitch, Eigen::Vector3f::UnitX() ) *
+              Eigen::Vector3f( 0, 0, -1 ) ).normalized();
+        const float depth = 1.5 + 0.25 * ( k % 4 ) + uniform( 0, 1.0 );
+
+        const cv::Point center( plane.region.x + plane.region.width / 2,
+                                plane.region.y + plane.region.height / 2 );
+        const Eigen::Vector3f origin = ray( center.x, center.y ) * depth;
+
+        plane.coeffs.head< 3 >() = normal;
+        plane.coeffs[3] = -normal.dot( origin );
+
+        plane.hasDoor = doorSpacing > 0 && k % doorSpacing == 0;
+        plane.door = cv::Rect( plane.region.x + plane.region.width * 3 / 10,
+                               plane.region.y + plane.region.height / 10,
+                               plane.region.width * 2 / 5,
+                               plane.region.height * 4 / 5 );
+
+        const int wallGray = 150 + int( uniform( 0, 80 ) );
+        const int doorGray = wallGray - 100;
+
+        plane.numPixels = 0;
+        for ( int v = plane.region.y; v < plane.region.br().y; v ++ ){
+            for ( int u = plane.region.x; u < plane.region.br().x; u ++ ){
+                Eigen::Vector3f p = intersect( plane.coeffs, u, v );
+
+                //the axial noise of the kinect grows with the square
+                //of the distance.
+                if ( depthNoise ){
+                    const float dz = p[2] - 0.4;
+                    const float sigma = 0.0012 + 0.0019 * dz * dz;
+                    p *= ( p[2] + gaussian( sigma ) ) / p[2];
+                }
+
+                const bool onDoor = plane.hasDoor &&
+                                    plane.door.contains( cv::Point( u, v ) );
+                int gray = onDoor ? doorGray : wallGray;
+                if ( depthNoise ){
+                    gray += int( gaussian( 3 ) );
+                }
+                gray = std::max( 0, std::min( 255, gray ) );
+
+                Point & point = cloud.points[ v * width + u ];
+                point.x = p[0];
+                point.y = p[1];
+                point.z = p[2];
+                point.r = point.g = point.b = gray;
+                plane.numPixels ++;
+            }
+        }
+
+        truthPlanes.push_back( plane );
+        addOutline( plane.region, k, false );
+        if ( plane.hasDoor ){
+            addOutline( plane.door, k, true );
+        }
+    }
+
+    punchHoles( cloud );
+}
+
+void SyntheticScene::addOutline( const cv::Rect & rect, int plane,
+                                 bool intensity )
+{
+    const Eigen::Vector4f & coeffs = truthPlanes[ plane ].coeffs;
+    const float x0 = rect.x, y0 = rect.y;
+    const float x1 = rect.br().x - 1, y1 = rect.br().y - 1;
+
+    const Eigen::Vector3f corners[4] = { intersect( coeffs, x0, y0 ),
+                                         intersect( coeffs, x1, y0 ),
+                                         intersect( coeffs, x1, y1 ),
+                                         intersect( coeffs, x0, y1 ) };
+    for ( int i = 0; i < 4; i ++ ){
+        truth_line line;
+        line.start = corners[i];
+        line.end = corners[ ( i + 1 ) % 4 ];
+        line.plane = plane;
+        line.intensity = intensity;
+        truthLines.push_back( line );
+    }
+}
+
+//kinect clouds have holes where the structured light does not come back.
+//these are modelled as small discs of NaN points.
+void SyntheticScene::punchHoles( PointCloud & cloud )
+{
+    if ( holeFraction <= 0 ){
+        return;
+    }
+
+    const float nan = std::numeric_limits< float >::quiet_NaN();
+    const int radius = 4;
+    const float discArea = M_PI * radius * radius;
+    const int numHoles = int( holeFraction * width * height / discArea );
+
+    for ( int h = 0; h < numHoles; h ++ ){
+        const int cu = int( uniform( 0, width ) );
+        const int cv = int( uniform( 0, height ) );
+        for ( int v = std::max( 0, cv - radius );
+              v <= std::min( height - 1, cv + radius ); v ++ ){
+            for ( int u = std::max( 0, cu - radius );
+                  u <= std::min( width - 1, cu + radius ); u ++ ){
+                if ( ( u - cu ) * ( u - cu ) + ( v - cv ) * ( v - cv ) <=
+                     radius * radius ){
+                    Point & p = cloud.points[ v * width + u ];
+                    p.x = p.y = p.z = nan;
+                }
+            }
+        }
+    }
+}
+
+int SyntheticScene::smallestPlane() const
+{
+    int smallest = 0;
+    for ( size_t i = 0; i < truthPlanes.size(); i ++ ){
+        if ( i == 0 || truthPlanes[i].numPixels < smallest ){
+            smallest = truthPlanes[i].numPixels;
+        }
+    }
+    return smallest;
+}
+
+scene_accuracy SyntheticScene::evaluate(
+                            const SegmentationResult & result,
+                            float angleTolerance,
+                            float distTolerance ) const
+{
+    scene_accuracy acc;
+    acc.truePlanes = truthPlanes.size();
+    acc.foundPlanes = result.size();
+    acc.matchedPlanes = 0;
+    acc.trueLines = truthLines.size();
+    acc.foundLines = 0;
+    acc.recalledLines = 0;
+    acc.preciseLines = 0;
+    acc.normalError = 0;
+
+    const float cosTolerance = cos( angleTolerance * M_PI / 180.0 );
+
+    //match every found plane with the best true plane that is not taken.
+    std::vector< bool > taken( truthPlanes.size(), false );
+    for ( size_t i = 0; i < result.size(); i ++ ){
+        const std::vector< float > & c = result[i].coeffs.values;
+        if ( c.size() < 4 ){
+            continue;
+        }
+        Eigen::Vector4f found( c[0], c[1], c[2], c[3] );
+        found /= found.head< 3 >().norm();
+
+        int best = -1;
+        float bestCos = cosTolerance;
+        for ( size_t j = 0; j < truthPlanes.size(); j ++ ){
+            if ( taken[j] ){
+                continue;
+            }
+            const Eigen::Vector4f & truth = truthPlanes[j].coeffs;
+            //the sign of the found coefficients is arbitrary
+            const float dot = found.head< 3 >().dot( truth.head< 3 >() );
+            const float sign = dot < 0 ? -1 : 1;
+            if ( sign * dot >= bestCos &&
+                 fabs( sign * found[3] - truth[3] ) < distTolerance ){
+                bestCos = sign * dot;
+                best = j;
+            }
+        }
+        if ( best >= 0 ){
+            taken[ best ] = true;
+            acc.matchedPlanes ++;
+            acc.normalError += acos( std::min( 1.0f, bestCos ) ) * 180.0 / M_PI;
+        }
+    }
+    if ( acc.matchedPlanes > 0 ){
+        acc.normalError /= acc.matchedPlanes;
+    }
+
+    //the depth and intensity lines of every plane are scored against the
+    //true lines of their kind.
+    std::vector< bool > recalled( truthLines.size(), false );
+    for ( size_t p = 0; p < result.size(); p ++ ){
+        const LinePosArray * sets[2] = { &result[p].depthLines,
+                                         &result[p].intensityLines };
+        for ( int s = 0; s < 2; s ++ ){
+            const bool intensity = s == 1;
+            const LinePosArray & lines = *sets[s];
+
+            for ( size_t j = 0; j + 1 < lines.size(); j += 2 ){
+                const Eigen::Vector3f a( lines[j].x, lines[j].y, lines[j].z );
+                const Eigen::Vector3f b( lines[j+1].x, lines[j+1].y,
+                                         lines[j+1].z );
+                acc.foundLines ++;
+
+                bool precise = false;
+                for ( size_t k = 0; k < truthLines.size(); k ++ ){
+                    const truth_line & t = truthLines[k];
+                    if ( t.intensity != intensity ){
+                        continue;
+                    }
+                    if ( segmentDistance( a, t.start, t.end ) < distTolerance &&
+                         segmentDistance( b, t.start, t.end ) < distTolerance ){
+                        precise = true;
+                        recalled[k] = true;
+                    }
+                }
+                if ( precise ){
+                    acc.preciseLines ++;
+                }
+            }
+        }
+    }
+    for ( size_t k = 0; k < recalled.size(); k ++ ){
+        if ( recalled[k] ){
+            acc.recalledLines ++;
+        }
+    }
+
+    return acc;
+}
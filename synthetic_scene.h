@@ -0,0 +1,125 @@
+#ifndef SYNTHETIC_SCENE
+#define SYNTHETIC_SCENE
+
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/StdVector>
+#include <boost/random/mersenne_twister.hpp>
+
+#include "plane_segmenter.h"
+
+//a plane of the synthetic scene. The coefficients are in
+//Ax + By + Cz + D = 0 form, with (A, B, C) of unit length.
+struct truth_plane {
+    Eigen::Vector4f coeffs;
+    int numPixels;
+
+    //the pixel rectangle the plane covers, and the door painted on it.
+    //hasDoor is false if the plane has no door.
+    cv::Rect region, door;
+    bool hasDoor;
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+//a line segment that the segmenter is expected to find. Depth lines are
+//the outlines of the planes, intensity lines are the outlines of the doors.
+struct truth_line {
+    Eigen::Vector3f start, end;
+    int plane;
+    bool intensity;
+};
+
+//how well a segmentation matches the ground truth of a scene.
+struct scene_accuracy {
+    int truePlanes, foundPlanes, matchedPlanes;
+    int trueLines, foundLines, recalledLines, preciseLines;
+
+    //mean angle in degrees between the matched plane normals.
+    double normalError;
+
+    double planeRecall() const;
+    double planePrecision() const;
+    double lineRecall() const;
+    double linePrecision() const;
+};
+
+
+//The SyntheticScene generates organized Kinect-like clouds of a known set of
+//planes, so that the segmenter can be timed and scored without recorded
+//data. Each plane is a tilted rectangle separated from its neighbours by a
+//gap with no returns, and some of the planes have a darker door painted on
+//them. The depth is disturbed with the axial noise model of the Kinect, and
+//random holes are punched into the cloud.
+class SyntheticScene
+{
+public:
+    typedef PlaneSegmenter::Point Point;
+    typedef PlaneSegmenter::PointCloud PointCloud;
+    typedef PlaneSegmenter::LinePosArray LinePosArray;
+    typedef std::vector< truth_plane, Eigen::aligned_allocator< truth_plane > >
+                TruthPlanes;
+
+    SyntheticScene( int width=640, int height=480,
+                    float focalLength=530.551 );
+
+    //turn the depth noise and the holes on or off. holeFraction is the
+    //fraction of the pixels that end up in holes.
+    void setNoise( bool depthNoise, float holeFraction );
+
+    //every doorSpacing'th plane gets a door, 0 disables doors.
+    void setDoorSpacing( int doorSpacing );
+
+    //builds a new scene with numPlanes planes. The same seed always gives
+    //the same scene.
+    void generate( int numPlanes, unsigned int seed, PointCloud & cloud );
+
+    const TruthPlanes & planes() const { return truthPlanes; }
+    const std::vector< truth_line > & lines() const { return truthLines; }
+
+    //the size of the smallest plane in pixels
+    int smallestPlane() const;
+
+    //compares the output of PlaneSegmenter::segment with the ground truth.
+    //planes match if their normals are within angleTolerance degrees and
+    //their offsets are within distTolerance meters. Lines match if both
+    //endpoints are within distTolerance of a true line of the same kind.
+    scene_accuracy evaluate( const SegmentationResult & result,
+                             float angleTolerance=5.0,
+                             float distTolerance=0.1 ) const;
+
+    float getFocalLength() const { return focalLength; }
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+
+private:
+    int width, height;
+    float focalLength, u0, v0;
+
+    bool depthNoise;
+    float holeFraction;
+    int doorSpacing;
+
+    boost::mt19937 rng;
+
+    TruthPlanes truthPlanes;
+    std::vector< truth_line > truthLines;
+
+    //the direction of the ray through pixel (u, v), with z = 1
+    Eigen::Vector3f ray( float u, float v ) const;
+
+    //the point where the ray through pixel (u, v) hits the plane
+    Eigen::Vector3f intersect( const Eigen::Vector4f & coeffs,
+                               float u, float v ) const;
+
+    //adds the four edges of a pixel rectangle, projected onto a plane.
+    void addOutline( const cv::Rect & rect, int plane, bool intensity );
+
+    void punchHoles( PointCloud & cloud );
+
+    float uniform( float low, float high );
+    float gaussian( float sigma );
+};
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef TASK_GROUP
+#define TASK_GROUP
+
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+//TaskGroup runs tasks on a few threads of its own. run hands it a task,
+//and wait blocks until every task that was handed to it has finished.
+//
+//The threads are started by the first task and kept until the group is
+//destroyed or its thread count changes, so a group that is used for every
+//frame does not start and join threads for every frame. A group that is
+//never handed a task holds no threads. A copy of a group only copies its
+//thread count, so that an object holding one stays copyable.
+//
+//The queue of tasks keeps its buffer, so once it has held the most tasks
+//it ever will, handing a task over allocates nothing as long as the task
+//is small enough for boost::function to hold it in place: a functor of
+//two pointers is, a boost::bind of a member function and its object is
+//not.
+class TaskGroup
+{
+public:
+
+    TaskGroup( int numThreads=2 ) : numThreads( numThreads ), pending( 0 ),
+                                    stopping( false ), nextTask( 0 ) {}
+
+    TaskGroup( const TaskGroup & other ) : numThreads( other.numThreads ),
+                                           pending( 0 ), stopping( false ),
+                                           nextTask( 0 ) {}
+
+    TaskGroup & operator=( const TaskGroup & other ) {
+        setNumThreads( other.numThreads );
+        return *this;
+    }
+
+    ~TaskGroup() { stopThreads(); }
+
+    void setNumThreads( int numThreads ) {
+        numThreads = numThreads > 0 ? numThreads : 1;
+        if ( numThreads != this->numThreads ){
+            stopThreads();
+            this->numThreads = numThreads;
+        }
+    }
+
+    void run( const boost::function< void () > & task ) {
+        if ( threads.empty() ){
+            for ( int i = 0; i < numThreads; i ++ ){
+                threads.push_back( boost::shared_ptr< boost::thread >(
+                    new boost::thread( boost::bind( &TaskGroup::workerLoop,
+                                                    this ) ) ) );
+            }
+        }
+        {
+            boost::mutex::scoped_lock lock( mutex );
+            if ( nextTask == tasks.size() ){
+                tasks.clear();
+                nextTask = 0;
+            }
+            tasks.push_back( task );
+            pending ++;
+        }
+        taskReady.notify_one();
+    }
+
+    //blocks until the tasks that were handed over have finished. The
+    //threads wait for the next ones.
+    void wait() {
+        boost::mutex::scoped_lock lock( mutex );
+        while ( pending > 0 ){
+            tasksDone.wait( lock );
+        }
+    }
+
+private:
+    int numThreads;
+    int pending;        //tasks that were handed over and have not finished
+    bool stopping;
+
+    //the tasks from nextTask on have not been started
+    std::vector< boost::function< void () > > tasks;
+    size_t nextTask;
+    boost::mutex mutex;
+    boost::condition_variable taskReady, tasksDone;
+    std::vector< boost::shared_ptr< boost::thread > > threads;
+
+    //finishes the tasks that are left and stops the threads.
+    void stopThreads() {
+        if ( threads.empty() ){
+            return;
+        }
+        {
+            boost::mutex::scoped_lock lock( mutex );
+            stopping = true;
+        }
+        taskReady.notify_all();
+        for ( size_t i = 0; i < threads.size(); i ++ ){
+            threads[i]->join();
+        }
+        threads.clear();
+        stopping = false;
+    }
+
+    void workerLoop() {
+        while ( true ){
+            boost::function< void () > task;
+            {
+                boost::mutex::scoped_lock lock( mutex );
+                while ( nextTask == tasks.size() && !stopping ){
+                    taskReady.wait( lock );
+                }
+                if ( nextTask == tasks.size() ){
+                    return;
+                }
+                task.swap( tasks[ nextTask ++ ] );
+            }
+            task();
+
+            boost::mutex::scoped_lock lock( mutex );
+            if ( -- pending == 0 ){
+                tasksDone.notify_all();
+            }
+        }
+    }
+};
+
+#endif